@@ -1,7 +1,7 @@
 from setuptools import setup, Extension, find_packages
 
 qtools = Extension('qtools', 
-        ['src/qtools_module.cc', 'src/base.cc','src/pricing.cc'],
-        extra_compile_args=['-fPIC'],
+        ['src/qtools_module.cc', 'src/base.cc','src/pricing.cc', 'src/kernels.cc', 'src/pde.cc'],
+        extra_compile_args=['-fPIC', '-std=c++17'],
         )
 setup(name='qtools', ext_modules=[qtools])
@@ -9,47 +9,377 @@
 #include <iostream>
 #include <cmath>
 #include <random>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <sys/mman.h>
 
 #include <boost/random.hpp>
 #include <boost/random/normal_distribution.hpp>
 
 #include "base.h"
+#include "kernels.h"
 
 
-// This function runs a simple Monte Carlo method by averaging a given function over M random numbers
-// drawn from a normal distribution as provided by the standard library
+// The FunctionClass versions of the Monte Carlo methods just instantiate the templates in base.h, so every
+// evaluation goes through a virtual call.
 
 double SimpleMC(const FunctionClass &f, long M) {
-    std::mt19937 gen;
-    std::normal_distribution<double> normdist(0,1);
+    return SimpleMC<FunctionClass>(f, M);
+}
+
+double SimpleMCUsingBoost(const FunctionClass &f, long M) {
+    return SimpleMCUsingBoost<FunctionClass>(f, M);
+}
+
+double ParallelMC(const FunctionClass &f, long M, int num_threads, uint64_t seed) {
+    return ParallelMC<FunctionClass>(f, M, num_threads, seed);
+}
 
-    gen.seed(12317);
+MCResult ParallelMCToTolerance(const FunctionClass &f, long max_M, double abs_tol, double rel_tol, int num_threads, uint64_t seed) {
+    return ParallelMCToTolerance(SingleOutput<FunctionClass>(f), max_M, abs_tol, rel_tol, num_threads, seed);
+}
 
+void MCAccumulator::add(const double *x, long n) {
+    if (n <= 0)
+      return;
     double sum = 0;
-    for (int i = 0; i < M; i++) {
-	double x = normdist(gen);
-        sum += f.eval(x);
-	sum += f.eval(-x);  // corresponding to  the 'antithetic' path, for better performance
+    for (long i = 0; i < n; i++)
+      sum += x[i];
+    MCAccumulator batch;
+    batch.count = n;
+    batch.mean = sum / n;
+    for (long i = 0; i < n; i++)
+      batch.m2 += (x[i] - batch.mean) * (x[i] - batch.mean);
+    merge(batch);
+}
+
+void MCAccumulator::merge(const MCAccumulator &other) {
+    if (other.count == 0)
+      return;
+    if (count == 0) {
+      *this = other;
+      return;
     }
-    return sum / (2*M);
+    long total = count + other.count;
+    double delta = other.mean - mean;
+    double w = (double) other.count / total;
+    mean += delta * w;
+    m2 += other.m2 + delta * delta * count * w;
+    count = total;
 }
 
-// This function runs a simple Monte Carlo method by averaging a given function over M random numbers
-// drawn from a normal distribution as provided by the boost library
+MCResult MCAccumulator::result(void) const {
+    MCResult r;
+    r.mean = mean;
+    r.count = count;
+    if (count > 1)
+      r.std_error = sqrt(m2 / ((count - 1) * (double) count));
+    return r;
+}
 
-double SimpleMCUsingBoost(const FunctionClass &f, long M) {
-    boost::mt19937 gen;
-    boost::normal_distribution<> normdist(0,1);
-    
-    boost::variate_generator<boost::mt19937&, boost::normal_distribution<> > varnorm(gen, normdist);
+void MCCovariance::add(const double *const *y, int /* num_outputs */, long n) {
+    if (n <= 0)
+      return;
+    MCCovariance batch;
+    batch.count = n;
+    for (int k = 0; k < 2; k++) {
+      double sum = 0;
+      for (long i = 0; i < n; i++)
+        sum += y[k][i];
+      batch.mean[k] = sum / n;
+    }
+    for (long i = 0; i < n; i++) {
+      double d0 = y[0][i] - batch.mean[0], d1 = y[1][i] - batch.mean[1];
+      batch.m2[0] += d0 * d0;
+      batch.m2[1] += d1 * d1;
+      batch.c += d0 * d1;
+    }
+    merge(batch);
+}
 
-    double sum = 0;
-    for (int i = 0; i < M; i++) {
-	double x = varnorm();
-        sum += f.eval(x);
-	sum += f.eval(-x); 
+void MCCovariance::merge(const MCCovariance &other) {
+    if (other.count == 0)
+      return;
+    if (count == 0) {
+      *this = other;
+      return;
+    }
+    long total = count + other.count;
+    double w = (double) other.count / total;
+    double d0 = other.mean[0] - mean[0], d1 = other.mean[1] - mean[1];
+    mean[0] += d0 * w;
+    mean[1] += d1 * w;
+    m2[0] += other.m2[0] + d0 * d0 * count * w;
+    m2[1] += other.m2[1] + d1 * d1 * count * w;
+    c += other.c + d0 * d1 * count * w;
+    count = total;
+}
+
+MCResult MCCovariance::controlled(double control_mean, double *beta) const {
+    double b = m2[1] > 0 ? c / m2[1] : 0;
+    MCResult r;
+    r.count = count;
+    r.mean = mean[0] - b * (mean[1] - control_mean);
+    if (count > 2) {
+      double residual = m2[0] - b * c;                                  // the sum of squares of Y - b * C about its mean
+      r.std_error = sqrt(std::max(residual, 0.0) / ((count - 2) * (double) count));
     }
-    return sum / (2*M);
+    if (beta)
+      *beta = b;
+    return r;
+}
+
+double SobolMC(const FunctionClass &f, long M, int num_replicates, Scrambling scrambling, int num_threads, uint64_t seed,
+               double *std_error) {
+    return SobolMC<FunctionClass>(f, M, num_replicates, scrambling, num_threads, seed, std_error);
+}
+
+void FunctionClass::eval_block(const double *x, double *y, long n) const {
+  for (long j = 0; j < n; j++)
+    y[j] = eval(x[j]);
+}
+
+std::atomic<unsigned> Workspace::release_epoch{0};
+std::atomic<std::size_t> Workspace::max_cached_bytes{256 << 20};
+
+static const std::size_t huge_page = 2 << 20;
+
+Workspace &Workspace::local(void) {
+  static thread_local Workspace workspace;
+  return workspace;
+}
+
+Workspace::Workspace(void) {
+  cache.reserve(max_cached_buffers);
+  epoch = release_epoch;
+}
+
+Workspace::~Workspace(void) {
+  clear();
+}
+
+double *Workspace::allocate(std::size_t capacity) {
+  static const bool use_huge_pages = getenv("QTOOLS_HUGEPAGES") == nullptr || strcmp(getenv("QTOOLS_HUGEPAGES"), "0") != 0;
+
+  std::size_t size = capacity * sizeof(double);
+  bool huge = size >= huge_page;
+  std::size_t align = huge ? huge_page : 64;
+  void *ptr = std::aligned_alloc(align, (size + align - 1) / align * align);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+  if (huge && use_huge_pages)
+    madvise(ptr, size, MADV_HUGEPAGE);                 // only a hint: failure just means regular pages
+#endif
+  return static_cast<double *>(ptr);
+}
+
+// Buffers are sized with an eighth to spare, rounded to a cache line, so that slightly deeper lattices than the last
+// one still find a cached buffer.
+
+double *Workspace::acquire(std::size_t n, std::size_t &capacity) {
+  check_epoch();
+
+  int best = -1;
+  for (int i = 0; i < (int) cache.size(); i++)
+    if (cache[i].capacity >= n && (best < 0 || cache[i].capacity < cache[best].capacity))
+      best = i;
+
+  if (best >= 0) {
+    double *ptr = cache[best].ptr;
+    capacity = cache[best].capacity;
+    bytes -= capacity * sizeof(double);
+    cache[best] = cache.back();
+    cache.pop_back();
+    return ptr;
+  }
+
+  capacity = (n + n / 8 + 7) / 8 * 8;
+  return allocate(capacity);
+}
+
+void Workspace::release(double *ptr, std::size_t capacity) {
+  check_epoch();
+
+  std::size_t size = capacity * sizeof(double);
+  while (!cache.empty() && bytes + size > limit()) {       // makes room by dropping the smallest buffers first
+    int smallest = 0;
+    for (int i = 1; i < (int) cache.size(); i++)
+      if (cache[i].capacity < cache[smallest].capacity)
+        smallest = i;
+    if (cache[smallest].capacity >= capacity)
+      break;
+    bytes -= cache[smallest].capacity * sizeof(double);
+    std::free(cache[smallest].ptr);
+    cache[smallest] = cache.back();
+    cache.pop_back();
+  }
+
+  if (bytes + size > limit() || (int) cache.size() >= max_cached_buffers) {
+    std::free(ptr);
+    return;
+  }
+  cache.push_back({ptr, capacity});
+  bytes += size;
+}
+
+void Workspace::clear(void) {
+  for (Buffer &buffer: cache)
+    std::free(buffer.ptr);
+  cache.clear();
+  bytes = 0;
+}
+
+void Workspace::check_epoch(void) {
+  unsigned current = release_epoch;
+  if (epoch != current) {
+    clear();
+    epoch = current;
+  }
+}
+
+void Workspace::release_all(void) {
+  release_epoch++;
+  local().check_epoch();
+}
+
+void Workspace::set_limit(std::size_t max_bytes) {
+  max_cached_bytes = max_bytes;
+}
+
+std::size_t Workspace::limit(void) {
+  return max_cached_bytes;
+}
+
+WorkspaceBuffer::~WorkspaceBuffer(void) {
+  if (ptr != nullptr)
+    Workspace::local().release(ptr, capacity);
+}
+
+void WorkspaceBuffer::resize(std::size_t n) {
+  count = n;
+  if (n <= capacity)
+    return;
+  if (ptr != nullptr)
+    Workspace::local().release(ptr, capacity);
+  ptr = Workspace::local().acquire(n, capacity);
+}
+
+Philox::Philox(uint64_t seed) {
+  key[0] = seed;
+  key[1] = seed >> 32;
+}
+
+// A job handed to ThreadPool::run(). The tasks are claimed one at a time through next, so faster threads simply end
+// up doing more of them. active counts the workers that picked the job from the queue and haven't left it yet; run()
+// can't return (and destroy the job) before it drops to zero.
+
+struct ThreadPool::Job {
+  const std::function<void(long)> *task;
+  long num_tasks;
+  std::atomic<long> next{0};
+  long done = 0;
+  int active = 0;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+ThreadPool &ThreadPool::instance(void) {
+  static ThreadPool pool;
+  return pool;
+}
+
+int ThreadPool::default_threads(void) {
+  int n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+ThreadPool::~ThreadPool(void) {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    stopping = true;
+  }
+  queue_cv.notify_all();
+  for (std::thread &worker: workers)
+    worker.join();
+}
+
+void ThreadPool::run_tasks(Job &job) {
+  long finished = 0;
+  for (long t = job.next++; t < job.num_tasks; t = job.next++) {
+    (*job.task)(t);
+    finished++;
+  }
+
+  std::lock_guard<std::mutex> lock(job.mutex);
+  job.done += finished;
+  if (job.done == job.num_tasks)
+    job.cv.notify_all();
+}
+
+void ThreadPool::work(void) {
+  while (true) {
+    Job *job;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex);
+      queue_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (stopping)
+        return;
+      job = queue.front();
+      queue.pop_front();
+      std::lock_guard<std::mutex> job_lock(job->mutex);
+      job->active++;
+    }
+
+    run_tasks(*job);
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->active--;
+    job->cv.notify_all();
+  }
+}
+
+void ThreadPool::run(long num_tasks, int num_threads, const std::function<void(long)> &task) {
+  if (num_threads <= 0)
+    num_threads = default_threads();
+  if (num_threads > num_tasks)
+    num_threads = num_tasks;
+
+  if (num_threads <= 1) {
+    for (long t = 0; t < num_tasks; t++)
+      task(t);
+    return;
+  }
+
+  Job job;
+  job.task = &task;
+  job.num_tasks = num_tasks;
+
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    while ((int) workers.size() < num_threads - 1)
+      workers.emplace_back(&ThreadPool::work, this);
+    for (int i = 0; i < num_threads - 1; i++)
+      queue.push_back(&job);
+  }
+  queue_cv.notify_all();
+
+  run_tasks(job);
+
+  {
+    // the workers that never got to the job don't need to anymore
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    for (auto it = queue.begin(); it != queue.end(); )
+      it = *it == &job ? queue.erase(it) : it + 1;
+  }
+
+  std::unique_lock<std::mutex> lock(job.mutex);
+  job.cv.wait(lock, [&job] { return job.done == job.num_tasks && job.active == 0; });
+}
+
+VanillaValueFromLog::VanillaValueFromLog(double strike_, double sign_): strike(strike_), sign(sign_) {
+  logstrike = log(strike);
 }
 
    
@@ -62,35 +392,40 @@ set_size(0);
 }
 
 int Lattice::size(void) {
-  return points.size();
+  return num_rows;
 }
 
-// This function sets the size of the lattice, and allocates enough memory.
+// This function sets the size of the lattice, and allocates enough memory in one block.
+// Resizing does not preserve the previous contents.
 
 void Lattice::set_size(int n) {
-  points.resize(n);
-  while (n-- > 0) 
-    points[n].resize(n+1);
+  num_rows = n > 0 ? n : 0;
+  points.resize(offset(num_rows));
+  std::fill(points.data(), points.data() + points.size(), 0.0);
 }
 
 void Lattice::set_initial(double initial_value) {
-  points[0][0] = initial_value;
+  points[0] = initial_value;
 }
 
-// This function sets the last column of the lattice to the given vector of doubles.
+// This function sets the last row of the lattice to the given vector of doubles.
 
 void Lattice::set_terminal(std::vector<double> terminal_values) {
-  long unsigned int n = points.size();
-  if (terminal_values.size() != n)
+  long unsigned int n = num_rows;
+  if (terminal_values.size() != n || n == 0)
     return;
 
+  double *last = row(n-1);
   for (long unsigned int i = 0 ; i < n ; i++) 
-    points[n-1][i] = terminal_values[i];       
+    last[i] = terminal_values[i];       
 
 }
 
 std::vector<double> Lattice::get_terminal(void) {
-  return points.back();
+  if (num_rows == 0)
+    return {};
+  const double *last = row(num_rows-1);
+  return std::vector<double>(last, last + num_rows);
 }
 
 // void Lattice::AdditiveForwardPass(double seed, double drift_delta, double stoch_delta) {
@@ -104,23 +439,21 @@ std::vector<double> Lattice::get_terminal(void) {
 // }
 
 void Lattice::AdditiveForwardPass(double seed, double logu, double logd) {
-    int n = points.size();
-    points[0][0] = seed;
+    int n = num_rows;
+    if (n == 0)
+      return;
+    points[0] = seed;
     for (int k = 0; k < n - 1 ; k++) { 
+	const double *cur = row(k);
+	double *next = row(k+1);
 	for (int i = 0; i < k + 1; i++) 
-	    points[k+1][i] = points[k][i] + logd;
-        points[k+1][k+1] = points[k][k] + logu;
+	    next[i] = cur[i] + logd;
+        next[k+1] = cur[k] + logu;
     }
 }
 
 void Lattice::AdditiveForwardPass(double seed, double logu) {
-    int n = points.size();
-    points[0][0] = seed;
-    for (int k = 0; k < n - 1 ; k++) { 
-	for (int i = 0; i < k + 1; i++) 
-	    points[k+1][i] = points[k][i] - logu;
-        points[k+1][k+1] = points[k][k] + logu;
-    }
+    AdditiveForwardPass(seed, logu, -logu);
 }
 
 // The values V(a,b) of the node (a,b) is set to the maximum of the following two quantities:
@@ -129,44 +462,466 @@ void Lattice::AdditiveForwardPass(double seed, double logu) {
 // 2:  f(L(a,b))
 //
 void Lattice::MultiplicativeRollback(Lattice &ref_lattice, double p, double q, FunctionClass &f) {
-    long unsigned int n = ref_lattice.size(); 
-    if (n!=points.size() || n==0)
+    int n = ref_lattice.size(); 
+    if (n != num_rows || n == 0)
 	    return;
 
-    auto it = points.rbegin();
-    auto ref_it = ref_lattice.points.rbegin();
-
-    for (long unsigned int i = 0; i < n; i++)                         // sets the terminal nodes to the intrinsic value
-      (*it)[i] = f.eval((*ref_it)[i]);
-
-    while (++it != points.rend()) {
-      ++ref_it;
-      for (long unsigned int i = 0; i < (*it).size(); i++) {
-        double t1 = q * (*(it-1))[i] + p * (*(it-1))[i+1] ;     //  computes the evalue of the derivative
-        double t2 = f.eval((*ref_it)[i]);	                //  computes the the intrinsic value 
-        (*it)[i] = t1 > t2 ? t1 : t2;                           //  sets value to the maximum of the two
-	  }
+    double *last = row(n-1);
+    const double *ref_last = ref_lattice.row(n-1);
+    for (int i = 0; i < n; i++)                                      // sets the terminal nodes to the intrinsic value
+      last[i] = f.eval(ref_last[i]);
+
+    for (int k = n - 2; k >= 0; k--) {
+      double *cur = row(k);
+      const double *next = row(k+1);
+      const double *ref = ref_lattice.row(k);
+      for (int i = 0; i <= k; i++) {
+        double t1 = q * next[i] + p * next[i+1] ;                     //  computes the evalue of the derivative
+        double t2 = f.eval(ref[i]);	                              //  computes the the intrinsic value 
+        cur[i] = t1 > t2 ? t1 : t2;                                   //  sets value to the maximum of the two
+      }
     }
 }
 
 
 void Lattice::MultiplicativeRollbackEU(Lattice &ref_lattice, double p, double q, FunctionClass &f) {
   // This is the same as MultiplicativeRollBack(), except it only computes the discounted expected value, so no early expiration, hence European type
-  long unsigned int n = ref_lattice.size(); 
-  if (n!=points.size() || n==0)
+  int n = ref_lattice.size(); 
+  if (n != num_rows || n == 0)
     return;
 
-  auto it = points.rbegin();
-  auto ref_it = ref_lattice.points.rbegin();
+  double *last = row(n-1);
+  const double *ref_last = ref_lattice.row(n-1);
+  for (int i = 0; i < n; i++)                                        // sets the terminal nodes to the intrinsic value
+    last[i] = f.eval(ref_last[i]);
+
+  for (int k = n - 2; k >= 0; k--) {
+    double *cur = row(k);
+    const double *next = row(k+1);
+    for (int i = 0; i <= k; i++) 
+      cur[i] = q * next[i] + p * next[i+1] ;                          //  computes the evalue of the derivative
+  }
+}
+
+
+RollingLattice::RollingLattice(int n) {
+  set_size(n);
+}
+
+RollingLattice::RollingLattice() {
+  set_size(0);
+}
+
+int RollingLattice::size(void) {
+  return values.size();
+}
+
+void RollingLattice::set_size(int n) {
+  values.resize(n > 0 ? n : 0);
+}
 
-  for (long unsigned int i = 0; i < n; i++)                         // sets the terminal nodes to the intrinsic value
-    (*it)[i] = f.eval((*ref_it)[i]);
+// This function sets the row to the intrinsic values at the last row of the lattice.
 
-  while (++it != points.rend()) {
-    ++ref_it;
-    for (long unsigned int i = 0; i < (*it).size(); i++) 
-      (*it)[i] = q * (*(it-1))[i] + p * (*(it-1))[i+1] ;      //  computes the evalue of the derivative
+void RollingLattice::set_terminal_vanilla(double seed, double logu, double logd, const VanillaValueFromLog &f) {
+  int n = values.size();
+  VanillaIntrinsicRow(values.data(), n, seed + (n - 1) * logd, logu - logd, f.get_strike(), f.get_sign());
+}
+
+// The rollbacks of vanilla payoffs compute the intrinsic value at every node, which would take one exponential per
+// node. Instead, LatticeUnderlying writes the underlying at node i of row k as exp(seed + k * logd) * exp(i * dx),
+// and tabulates the second factor once per rollback: n exponentials for the table, and one per row. In the
+// recombining models (logu = -logd) the table holds the 2n-1 distinct values of the underlying, up to the factor of
+// the row, and in the others it plays the same role. If the table would overflow, which takes lattices of hundreds
+// of thousands of steps with a large vol, it falls back to one exponential per node.
+
+class LatticeUnderlying {
+  public:
+    LatticeUnderlying(long n, double seed_, double logu, double logd_): seed(seed_), logd(logd_), dx(logu - logd_) {
+      tabulated = n * std::fabs(dx) < 700;
+      if (tabulated) {
+        growth.resize(n);
+        for (long i = 0; i < n; i++)
+          growth[i] = i * dx;
+        ExpRow(growth.data(), growth.data(), n);
+      }
+    }
+
+    // Sets s[j] to the underlying at node j of row k, for 0 <= j < count.
+    void row(double *s, long count, long k) const {
+      if (tabulated) {
+        double scale = exp(seed + k * logd);
+        for (long j = 0; j < count; j++)
+          s[j] = scale * growth[j];
+      } else {
+        for (long j = 0; j < count; j++)
+          s[j] = seed + k * logd + j * dx;
+        ExpRow(s, s, count);
+      }
+    }
+
+  protected:
+    WorkspaceBuffer growth;
+    bool tabulated;
+    double seed, logd, dx;
+};
+
+// VanillaStepper runs the rollback steps of a vanilla payoff on the underlying of LatticeUnderlying.
+
+class VanillaStepper: public LatticeUnderlying {
+  public:
+    VanillaStepper(long n, double seed, double logu, double logd, const VanillaValueFromLog &f):
+      LatticeUnderlying(n, seed, logu, logd), strike(f.get_strike()), sign(f.get_sign()) {}
+
+    // Rolls back entries first, ..., first + count - 1 of row k in place, v pointing at entry first.
+    void step(double *v, long count, long first, long k, double p, double q) const {
+      if (tabulated)
+        VanillaRollbackStepScaled(v, count, p, q, exp(seed + k * logd), growth.data() + first, strike, sign);
+      else
+        VanillaRollbackStep(v, count, first, p, q, seed + k * logd, dx, strike, sign);
+    }
+
+    // The intrinsic value at node i of row k.
+    double intrinsic(long i, long k) const {
+      double spot = tabulated ? exp(seed + k * logd) * growth[i] : exp(seed + k * logd + i * dx);
+      return sign * (spot - strike);
+    }
+
+    // Sets entries first, ..., first + count - 1 of row k to their intrinsic values, v pointing at entry first.
+    void exercise(double *v, long count, long first, long k) const {
+      if (tabulated)
+        VanillaExerciseRowScaled(v, count, exp(seed + k * logd), growth.data() + first, strike, sign);
+      else
+        VanillaIntrinsicRow(v, count, seed + k * logd + first * dx, dx, strike, sign);
+    }
+
+  private:
+    double strike, sign;
+};
+
+double RollingLattice::RollbackVanilla(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, bool from_row, int stop_row) {
+  int n = values.size();
+  if (n == 0)
+    return 0;
+
+  if (n >= wavefront_rows)
+    return RollbackWavefront(seed, logu, logd, p, q, f, from_row, stop_row);
+
+  if (!from_row)
+    set_terminal_vanilla(seed, logu, logd, f);
+
+  VanillaStepper stepper(n, seed, logu, logd, f);
+  double *v = values.data();
+  for (int k = n - 2; k >= stop_row; k--) {
+    stepper.step(v, k + 1, 0, k, p, q);
+    record_top_rows(k, v);
   }
+  return v[0];
 }
 
+double RollingLattice::RollbackFromRow(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f) {
+  return RollbackVanilla(seed, logu, logd, p, q, f, true);
+}
+
+const double *RollingLattice::RollbackToRow(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, int row) {
+  RollbackVanilla(seed, logu, logd, p, q, f, false, row);
+  return values.data();
+}
+
+// The exercise region of an American put is the band of nodes below a boundary, and that of a call the band above
+// one, so at each step RollbackBoundary() only has to locate the boundary: it starts from where it was at the next
+// step, which is at most a node or two away, and moves it one node at a time, comparing the continuation and
+// intrinsic values of the nodes it crosses. The rest of the row then takes no comparison at all: the continuation
+// region is one European step, and the exercise region is filled with the intrinsic values, without computing the
+// continuation values.
+//
+// The band holds when p >= 0, q >= 0 and q * d + p * u <= 1, with u and d the up and down factors: by induction from
+// expiry, V + S is then nondecreasing along each row for puts and V - S nonincreasing for calls, so the intrinsic
+// value minus the continuation value is monotone along the next row, and changes sign at most once. That covers the
+// usual models, but not CRR when p > 1, nor Trigeorgis at rates <= 0, whose q * d + p * u is a little above 1 and
+// whose exercise region can then end before the top of the row. Otherwise each row takes the full comparison, as in
+// Rollback(), and the boundary is found by scanning the whole row.
+
+double RollingLattice::RollbackBoundary(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, std::vector<double> *boundary) {
+  int n = values.size();
+  if (boundary)
+    boundary->assign(n > 1 ? n - 1 : 0, std::numeric_limits<double>::quiet_NaN());
+  if (n == 0)
+    return 0;
+
+  set_terminal_vanilla(seed, logu, logd, f);
+  VanillaStepper stepper(n, seed, logu, logd, f);
+  double *v = values.data();
+  bool low = f.get_sign() < 0;                                        //  whether the region is at the low end
+  bool banded = p >= 0 && q >= 0 && q * exp(logd) + p * exp(logu) <= 1 + 1e-14;   //  allowing for rounding
+
+  // b is the first node above the exercise region for puts, and the first node in it for calls. At expiry the
+  // region is where the option is in the money.
+  long b = 0;
+  while (b < n && (f.get_sign() * (exp(seed + b * logu + (n - 1 - b) * logd) - f.get_strike()) > 0) == low)
+    b++;
+
+  for (long k = n - 2; k >= 0; k--) {
+    auto exercised = [&](long i) { return stepper.intrinsic(i, k) > std::max(q * v[i] + p * v[i + 1], 0.0); };
+    if (!banded) {
+      if (boundary) {
+        long i = low ? k : 0;                                         //  scanning in from the far end of the row
+        while (i >= 0 && i <= k && !exercised(i))
+          i += low ? -1 : 1;
+        if (i >= 0 && i <= k)
+          (*boundary)[k] = exp(seed + i * logu + (k - i) * logd);
+      }
+      stepper.step(v, k + 1, 0, k, p, q);
+      record_top_rows(k, v);
+      continue;
+    }
 
+    b = std::min(b, k + 1);
+    if (low) {
+      while (b > 0 && !exercised(b - 1))
+        b--;
+      while (b <= k && exercised(b))
+        b++;
+      EuropeanRollbackStep(v + b, k + 1 - b, p, q);
+      stepper.exercise(v, b, 0, k);
+    } else {
+      while (b <= k && !exercised(b))
+        b++;
+      while (b > 0 && exercised(b - 1))
+        b--;
+      EuropeanRollbackStep(v, b, p, q);                               //  reads entry b, so goes first
+      stepper.exercise(v + b, k + 1 - b, b, k);
+    }
+    if (boundary && (low ? b > 0 : b <= k))
+      (*boundary)[k] = exp(seed + (low ? b - 1 : b) * logu + (k - (low ? b - 1 : b)) * logd);
+    record_top_rows(k, v);
+  }
+  return v[0];
+}
+
+void RollingLattice::get_top_rows(double rows[6]) const {
+  std::copy(top_rows, top_rows + 6, rows);
+}
+
+void RollingLattice::set_num_threads(int n) {
+  num_threads = n;
+}
+
+// For deep lattices, going through the whole row once per step is limited by memory bandwidth, and uses one core.
+// RollbackWavefront() instead splits the row into tiles of wavefront_tile entries, and rolls back wavefront_levels
+// steps at a time in two parallel phases:
+//
+// 1. Each tile rolls back its own entries for all the steps, while they stay in cache. Entry i of row m needs entries
+//    i and i+1 of row m+1, so a tile [a,b) can only compute [a, b-l) after l steps: a trapezoid. Before overwriting
+//    entry a, it saves it, since the tile to its left will need it.
+//
+// 2. Each tile fills in the triangle it left out, [b-l, b) after l steps, using the entries saved by the next tile.
+//
+// The tiles of each phase are independent, and each entry goes through the same VanillaStepper::step() computation as
+// in the serial rollback, so the result is bit for bit the same.
+
+double RollingLattice::RollbackWavefront(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, bool from_row, int stop_row) {
+  long n = values.size();
+
+  if (!from_row)
+    set_terminal_vanilla(seed, logu, logd, f);
+  VanillaStepper stepper(n, seed, logu, logd, f);
+  double *v = values.data();
+
+  long k = n - 1;                                                     //  v holds row k, which has k+1 entries
+  WorkspaceBuffer saved;
+  long last = std::max(2, stop_row);
+  while (k > last) {                                                  //  the last steps are done below
+    long levels = std::min<long>(wavefront_levels, k - last);
+    long len = k + 1;
+
+    // The last tile takes the remainder of the row. It must be wider than levels for the triangles of phase 2 to be
+    // complete, so a short remainder is merged into the tile before it.
+    long num_tiles = std::max<long>(1, (len - levels - 1) / wavefront_tile + 1);
+    saved.resize(num_tiles * levels);
+
+    ThreadPool::instance().run(num_tiles, num_threads, [&](long t) {
+      long a = t * wavefront_tile;
+      long b = t == num_tiles - 1 ? len : a + wavefront_tile;
+      for (long l = 1; l <= levels; l++) {
+        saved[t * levels + l - 1] = v[a];
+        stepper.step(v + a, b - l - a, a, k - l, p, q);
+      }
+    });
+
+    ThreadPool::instance().run(num_tiles - 1, num_threads, [&](long t) {
+      long b = (t + 1) * wavefront_tile;
+      const double *next_saved = saved.data() + (t + 1) * levels;
+      for (long l = 1; l <= levels; l++) {
+        stepper.step(v + b - l, l - 1, b - l, k - l, p, q);
+        double edge[2] = {v[b - 1], next_saved[l - 1]};
+        stepper.step(edge, 1, b - 1, k - l, p, q);
+        v[b - 1] = edge[0];
+      }
+    });
+
+    k -= levels;
+  }
+
+  record_top_rows(k, v);
+  for (k = k - 1; k >= stop_row; k--) {
+    stepper.step(v, k + 1, 0, k, p, q);
+    record_top_rows(k, v);
+  }
+  return v[0];
+}
+
+double RollingLattice::RollbackEUFromTerminal(double p, double q) {
+  int n = values.size();
+  double *v = values.data();
+  for (int k = n - 2; k >= 0; k--) {
+    EuropeanRollbackStep(v, k + 1, p, q);                             //  computes the evalue of the derivative
+    record_top_rows(k, v);
+  }
+  return v[0];
+}
+
+std::vector<double> RollingLattice::RollbackChain(double seed, double logu, double logd, double p, double q, const std::vector<double> &strikes, double sign) {
+  long n = values.size();
+  long num_strikes = strikes.size();
+  std::vector<double> prices(num_strikes, 0);
+  if (n == 0 || num_strikes == 0)
+    return prices;
+
+  LatticeUnderlying underlying(n, seed, logu, logd);
+  WorkspaceBuffer spots(n), block_strikes(chain_block), block(n * chain_block);
+
+  for (long first = 0; first < num_strikes; first += chain_block) {
+    long count = num_strikes - first < chain_block ? num_strikes - first : chain_block;
+    long width = (count + 7) / 8 * 8;                                 //  the kernels work on multiples of 8 strikes
+
+    for (long j = 0; j < width; j++)                                  //  pads the block by repeating the last strike
+      block_strikes[j] = strikes[first + (j < count ? j : count - 1)];
+
+    underlying.row(spots.data(), n, n - 1);
+    VanillaChainIntrinsic(block.data(), n, width, spots.data(), block_strikes.data(), sign);
+
+    for (long k = n - 2; k >= 0; k--) {
+      underlying.row(spots.data(), k + 1, k);
+      VanillaChainStep(block.data(), k + 1, width, spots.data(), block_strikes.data(), p, q, sign);
+    }
+
+    for (long j = 0; j < count; j++)
+      prices[first + j] = block[j];
+  }
+  return prices;
+}
+
+// The value used for node i of row k just outside the band of RollbackTruncated(), where disc is the discount factor
+// of one step.
+
+double RollingLattice::TruncationBoundary(double seed, double logu, double logd, double disc, int k, int i, const VanillaValueFromLog &f) {
+  int n = values.size();
+  double spot = exp(seed + i * logu + (k - i) * logd);
+  double sign = f.get_sign(), strike = f.get_strike();
+  double intrinsic = sign * (spot - strike);
+  double asymptote = sign * (spot - strike * pow(disc, n - 1 - k));
+  return std::max(std::max(intrinsic, asymptote), 0.0);
+}
+
+double RollingLattice::RollbackTruncated(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, double num_std, double *error_bound) {
+  int n = values.size();
+  if (error_bound)
+    *error_bound = 0;
+  if (n == 0)
+    return 0;
+
+  // In terms of i, the number of up moves, the band is centered on k * up and has half width half_width.
+  double up = p / (p + q);
+  double half_width = std::max(num_std * sqrt((n - 1) * up * (1 - up)), 1.0);
+  double dx = logu - logd;
+  auto band_lo = [&](int k) { return (int) std::max(0.0, ceil(k * up - half_width)); };
+  auto band_hi = [&](int k) { return (int) std::min((double) k, floor(k * up + half_width)); };
+
+  double *v = values.data();
+  int lo = band_lo(n - 1), hi = band_hi(n - 1);
+  bool truncated = lo > 0 || hi < n - 1;
+  VanillaIntrinsicRow(v + lo, hi - lo + 1, seed + (n - 1) * logd + lo * dx, dx, f.get_strike(), f.get_sign());
+  VanillaStepper stepper(n, seed, logu, logd, f);
+
+  for (int k = n - 2; k >= 0; k--) {
+    int next_lo = lo, next_hi = hi;                                   //  the entries of row k+1 rolled back so far
+    lo = band_lo(k);
+    hi = band_hi(k);
+    truncated = truncated || lo > 0 || hi < k;
+
+    for (int i = lo; i < next_lo; i++)
+      v[i] = TruncationBoundary(seed, logu, logd, p + q, k + 1, i, f);
+    for (int i = next_hi + 1; i <= hi + 1; i++)
+      v[i] = TruncationBoundary(seed, logu, logd, p + q, k + 1, i, f);
+
+    stepper.step(v + lo, hi - lo + 1, lo, k, p, q);
+  }
+
+  if (error_bound && truncated)
+    *error_bound = 2 * erfc(num_std / sqrt(2.0)) * f.get_strike();
+  return v[0];
+}
+
+double EuropeanBinomialSum(long N, double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f) {
+  if (N <= 0)
+    return f.eval(seed);
+
+  // The nodes in the money form the range [lo, hi] of up-move counts: above the strike for calls, below for puts.
+  // With logu > logd, node i is above the strike when i > (log(strike) - seed - N * logd) / (logu - logd).
+  double strike = f.get_strike(), sign = f.get_sign();
+  double dx = logu - logd;
+  double cut = (log(strike) - seed - N * logd) / dx;
+  long lo = 0, hi = N;
+  if (sign > 0)
+    lo = (long) std::min<double>(N + 1, std::max(0.0, floor(cut) + 1));
+  else
+    hi = (long) std::max<double>(-1, std::min<double>(N, ceil(cut) - 1));
+  if (lo > hi)
+    return 0;
+
+  double disc = p + q, up = p / disc;
+  double ratio = exp(log(up) - log1p(-up));                          //  p/q
+  long mode = std::min(std::max((long) floor((N + 1) * up), lo), hi);
+  double w_mode = exp(lgamma(N + 1.0) - lgamma(mode + 1.0) - lgamma(N - mode + 1.0) + mode * log(up) + (N - mode) * log1p(-up));
+
+  auto payoff = [&](long i) { return std::max(sign * (exp(seed + i * logu + (N - i) * logd) - strike), 0.0); };
+  const double eps = 1e-18;
+
+  double sum = w_mode * payoff(mode);
+  double w = w_mode, last = sum;
+  for (long i = mode + 1; i <= hi; i++) {
+    w *= (double) (N - i + 1) / i * ratio;
+    double term = w * payoff(i);
+    sum += term;
+    if (term < eps * sum && term <= last)
+      break;
+    last = term;
+  }
+  w = w_mode;
+  last = sum;
+  for (long i = mode - 1; i >= lo; i--) {
+    w *= (double) (i + 1) / (N - i) / ratio;
+    double term = w * payoff(i);
+    sum += term;
+    if (term < eps * sum && term <= last)
+      break;
+    last = term;
+  }
+  return sum * exp(N * log(disc));
+}
+
+// The FunctionClass versions look for vanilla payoffs first, so they still get the vectorized kernels.
+
+double RollingLattice::Rollback(double seed, double logu, double logd, double p, double q, FunctionClass &f) {
+  VanillaValueFromLog *vanilla = dynamic_cast<VanillaValueFromLog *>(&f);
+  if (vanilla != nullptr)
+    return RollbackVanilla(seed, logu, logd, p, q, *vanilla);
+  return Rollback<FunctionClass>(seed, logu, logd, p, q, f);
+}
+
+double RollingLattice::RollbackEU(double seed, double logu, double logd, double p, double q, FunctionClass &f) {
+  VanillaValueFromLog *vanilla = dynamic_cast<VanillaValueFromLog *>(&f);
+  if (vanilla != nullptr)
+    return RollbackEU<VanillaValueFromLog>(seed, logu, logd, p, q, *vanilla);
+  return RollbackEU<FunctionClass>(seed, logu, logd, p, q, f);
+}
@@ -6,19 +6,144 @@
 #define BASE_H
 
 #include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <type_traits>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+
+#include <boost/random.hpp>
+#include <boost/random/normal_distribution.hpp>
+
+#include "kernels.h"
+
+// The class Workspace keeps the memory of lattices around between pricing calls, so that repeated calls at similar
+// depths don't allocate (or page fault) at all. Each thread has its own workspace, returned by Workspace::local(), so
+// there is no locking. Buffers given back with release() are cached, and acquire() hands out the smallest cached
+// buffer that is large enough, or allocates a new one with some room to grow.
+//
+// Buffers are aligned to 64 bytes. Those of 2 MB or more are aligned to 2 MB and advised to use transparent huge
+// pages, unless the environment variable QTOOLS_HUGEPAGES is set to 0.
+//
+// Each thread caches at most limit() bytes (256 MB by default) in at most max_cached_buffers buffers; buffers that
+// don't fit are freed when released. release_all() frees the cached buffers of every thread: those of the calling
+// thread right away, and those of the other threads the next time they use their workspace.
+
+class Workspace {
+  public:
+    static Workspace &local(void);
+
+    double *acquire(std::size_t n, std::size_t &capacity);
+    // Returns a buffer of at least n doubles, and sets capacity to its actual size.
+
+    void release(double *ptr, std::size_t capacity);
+    // Gives back a buffer returned by acquire() (on this thread's workspace or another's).
+
+    void clear(void);
+    // Frees the cached buffers of this thread.
+
+    std::size_t cached_bytes(void) const { return bytes; }
+
+    static void release_all(void);
+    static void set_limit(std::size_t max_bytes);
+    static std::size_t limit(void);
+
+    static const int max_cached_buffers = 16;
+
+    ~Workspace(void);
+
+  private:
+    struct Buffer {
+      double *ptr;
+      std::size_t capacity;
+    };
+
+    std::vector<Buffer> cache;
+    std::size_t bytes = 0;
+    unsigned epoch = 0;                  // the value of release_epoch when the cache was last emptied
+
+    static std::atomic<unsigned> release_epoch;
+    static std::atomic<std::size_t> max_cached_bytes;
+
+    Workspace(void);
+    void check_epoch(void);
+    static double *allocate(std::size_t capacity);
+};
+
+// A resizable array of doubles drawn from the workspace of the thread that sizes it. Unlike std::vector, resizing
+// doesn't preserve or initialize the contents.
+
+class WorkspaceBuffer {
+  public:
+    WorkspaceBuffer(void) {}
+    explicit WorkspaceBuffer(std::size_t n) { resize(n); }
+    WorkspaceBuffer(const WorkspaceBuffer &) = delete;
+    WorkspaceBuffer &operator=(const WorkspaceBuffer &) = delete;
+    ~WorkspaceBuffer(void);
+
+    void resize(std::size_t n);
+
+    std::size_t size(void) const { return count; }
+    double *data(void) { return ptr; }
+    const double *data(void) const { return ptr; }
+    double &operator[](std::size_t i) { return ptr[i]; }
+    double operator[](std::size_t i) const { return ptr[i]; }
+
+  private:
+    double *ptr = nullptr;
+    std::size_t count = 0, capacity = 0;
+};
+
 // An abstract function class that will be passed to the numerical methods 
 // We can't use a function pointer, because some of these functions will be non-constant methods of instantiated classes
 
 class FunctionClass {
     public:
     virtual double eval(double x) const = 0; 
+
+    virtual void eval_block(const double *x, double *y, long n) const;
+    // Sets y[j] = eval(x[j]) for 0 <= j < n. Subclasses can override this with a vectorized version, which the
+    // Monte Carlo drivers use.
+};
+
+// The intrinsic value of a vanilla option as a function of the log of the underlying,
+//
+//    max(sign * (exp(x) - strike), 0)
+//
+// with sign = 1 for calls and -1 for puts. RollingLattice recognizes subclasses of this class and runs them through
+// the vectorized kernels in kernels.h, rather than calling eval() on one node at a time.
+
+class VanillaValueFromLog: public virtual FunctionClass {
+  public:
+    double eval(double x) const;
+    VanillaValueFromLog(double strike_, double sign_);
+
+    double get_strike(void) const { return strike; }
+    double get_sign(void) const { return sign; }
+  protected:
+    double logstrike, strike, sign;
 };
 
+inline double VanillaValueFromLog::eval(double logvalue) const {
+  double payoff = sign * (exp(logvalue) - strike);
+  return payoff > 0 ? payoff : 0;
+}
+
 // The class Lattice implements what's called the "binary tree model" for derivative pricing in quant finance..
 // But the structure in those models is not actually a tree, rather a truncated lattice, hence the name of this class.
 // 
-// Given size n, simulation data is stored in n+1 vectors of size 1,...,n. 
-// The values in the kth vector will correspond to lattice points (a,b) with a+b=k and a,b>=0.
+// Given size n, simulation data is stored in a single contiguous buffer holding n rows of size 1,...,n, one after
+// the other. The values in the kth row will correspond to lattice points (a,b) with a+b=k and a,b>=0, and start at
+// offset k*(k+1)/2 in the buffer. Use operator()(k,i) or row(k) to get at them.
 
 // This corresponds to a binomial model with "n steps".
 //
@@ -44,11 +169,15 @@ class FunctionClass {
 //
 class Lattice {
   public:
-    std::vector<std::vector<double>> points = {{}};
-    
     int size(void);
 
-    // the set_size method will also allocate the required memory, which is (n+1)*(n+2)/2 doubles
+    double &operator()(int k, int i) { return points[offset(k) + i]; }   // the ith node of the kth row
+    double operator()(int k, int i) const { return points[offset(k) + i]; }
+
+    double *row(int k) { return points.data() + offset(k); }
+    const double *row(int k) const { return points.data() + offset(k); }
+
+    // the set_size method will also allocate the required memory, which is n*(n+1)/2 doubles in one block
     void set_size(int n);  
 
     void set_initial(double initial_value);
@@ -93,17 +222,762 @@ class Lattice {
     void MultiplicativeRollbackEU(Lattice &ref_lattice, double p, double q, FunctionClass &f);
 
     // Same as MultiplicativeRollback(), except without comparing with intrinsic value.
+
+  private:
+    int num_rows = 0;
+    WorkspaceBuffer points;
+
+    static long offset(int k) { return (long) k * (k + 1) / 2; }
+};
+
+// The class RollingLattice computes the same backward pass as Lattice::MultiplicativeRollback(), but without ever
+// materializing the full lattice. Only one row of n doubles is kept, and it is overwritten in place as the rollback
+// moves from the last row to the first:
+//
+//    V(k,i) = q * V(k+1,i) + p * V(k+1,i+1)
+//
+// only reads entries i and i+1 of the next row, so going through i in increasing order never clobbers anything that
+// is still needed.
+//
+// The log values of the underlying are not stored either. The node with i up-moves and k-i down-moves has log value
+//
+//    seed + i * logu + (k-i) * logd
+//
+// which is computed on the fly, so there is no need for a separate lattice filled by AdditiveForwardPass().
+//
+// Memory use is O(n) instead of O(n^2), which for n = 4000 is 32 KB instead of two lattices of 64 MB each.
+//
+// When f is a VanillaValueFromLog, each row is processed by the vectorized kernels in kernels.h: several nodes at a
+// time, with a vectorized exponential for the intrinsic value.
+//
+// The rollbacks are templates on the type of f, so that for a concrete (final) payoff class eval() is inlined into the
+// inner loop. The versions taking a FunctionClass are thin adapters around them, for payoffs only known at runtime.
+//
+class RollingLattice {
+  public:
+    int size(void);
+
+    // the set_size method allocates a single row of n doubles, enough for a lattice with n rows (n-1 steps)
+    void set_size(int n);
+
+    RollingLattice(void);
+    RollingLattice(int n);
+
+    template <class Payoff>
+    double Rollback(double seed, double logu, double logd, double p, double q, const Payoff &f);
+    // Returns the value at the root of the lattice, using the same conventions as Lattice::MultiplicativeRollback():
+    // p and q are the (discounted) weights of the up and down moves, and f takes the log of the underlying as input.
+
+    template <class Payoff>
+    double RollbackEU(double seed, double logu, double logd, double p, double q, const Payoff &f);
+    // Same as Rollback(), except without comparing with intrinsic value.
+
+    double Rollback(double seed, double logu, double logd, double p, double q, FunctionClass &f);
+    double RollbackEU(double seed, double logu, double logd, double p, double q, FunctionClass &f);
+    // Same as above, dispatching on the dynamic type of f.
+
+    std::vector<double> RollbackChain(double seed, double logu, double logd, double p, double q, const std::vector<double> &strikes, double sign);
+    // Returns the values at the root of the lattice of American vanilla options at each of the given strikes, with
+    // sign = 1 for calls and -1 for puts. This gives the same results as calling Rollback() with a VanillaValueFromLog
+    // for each strike, but the strikes are rolled back together: each node of the lattice holds a small vector of
+    // values, one per strike, which the kernels process several strikes at a time. The underlying at the nodes is
+    // then only computed once for all the strikes, from the same table of exponentials as the vanilla rollbacks.
+    //
+    // The strikes are processed in blocks of chain_block, which keeps the working set of a block at n * chain_block
+    // doubles (1 MB for n = 4000), so that a rollback step stays in cache.
+
+    static const int chain_block = 32;
+
+    double *last_row(void) { return values.data(); }
+    double RollbackFromRow(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f);
+    // Same as Rollback(), except that the last row of the lattice isn't set to the intrinsic values of f: the caller
+    // fills last_row() first, entry i with the value at log value seed + i * logu + (size() - 1 - i) * logd. This is
+    // how the values of the last row can come from elsewhere, for instance from the Black-Scholes formula.
+
+    const double *RollbackToRow(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, int row);
+    // Same as Rollback(), except that the rollback stops at the given row, and returns its row+1 values, entry i at
+    // log value seed + i * logu + (row - i) * logd. Started row steps before the valuation date, a lattice gives the
+    // values at a whole range of spots from one rollback. The values stay valid until the next rollback.
+
+    double RollbackBoundary(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, std::vector<double> *boundary = nullptr);
+    // Same as Rollback(), for payoffs whose exercise region on each row is a single band of nodes at one end: the
+    // nodes below a boundary for puts, and above one for calls, as for vanilla options in the usual models. Instead
+    // of comparing the continuation and intrinsic values at every node, the rollback tracks the boundary from one
+    // step to the next, and only compares them on the few nodes around it. The rollback is serial.
+    //
+    // The band is guaranteed when p >= 0, q >= 0 and q * exp(logd) + p * exp(logu) <= 1, see base.cc. For other
+    // steps, such as CRR with p > 1 or Trigeorgis at rates <= 0, every node is compared as in Rollback(), so the
+    // result is the same either way.
+    //
+    // If boundary isn't null, it is set to the n-1 values of the underlying on the boundary of rows 0, ..., n-2: the
+    // largest exercised node for puts, and the smallest for calls, or NaN when no node of the row is exercised.
+
+    void get_top_rows(double rows[6]) const;
+    // After a rollback by Rollback(), RollbackEU() or their FunctionClass versions on a lattice of at least 3 rows,
+    // sets rows to the values of the first three rows: row 2 in rows[0..2], row 1 in rows[3..4] and the root in
+    // rows[5]. The Greeks can be read off them, see PriceAmericanGreeks() in pricing.cc.
+
+    void set_num_threads(int n);
+    // Sets the number of threads the rollbacks of vanilla payoffs may use on lattices of at least wavefront_rows rows
+    // (0, the default, means one per core). See RollbackWavefront() in base.cc. The result doesn't depend on it.
+
+    static const int wavefront_rows = 16384;
+    static const int wavefront_tile = 4096;
+    static const int wavefront_levels = 512;
+
+    double RollbackTruncated(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, double num_std, double *error_bound = nullptr);
+    // Same as Rollback(), except that only the nodes within num_std standard deviations of the expected log value of
+    // the underlying are computed. With p' = p / (p+q) the probability of an up move and n-1 steps, the standard
+    // deviation of the log value at expiry is s = sqrt((n-1) p' (1-p')) * (logu - logd), and at step k the nodes kept
+    // are those with log value within num_std * s of seed + k * (p' logu + (1-p') logd). That's O(num_std * sqrt(n))
+    // nodes per row instead of O(n), so the work goes from O(n^2) to O(num_std * n^1.5).
+    //
+    // The values just outside the band are not rolled back, but set to max(intrinsic value, sign * (S - K * D)), with
+    // S the underlying, K the strike and D the discount factor to expiry: the limit of the option value far in or
+    // out of the money.
+    //
+    // If error_bound isn't null, it is set to a bound on the error due to the truncation (0 if nothing is cut). A path
+    // of the underlying reaches the edge of the band with probability at most 2 * erfc(num_std / sqrt(2)), by the
+    // reflection principle, and the boundary values above are off by less than K at the edge, so the bound is
+    // 2 * erfc(num_std / sqrt(2)) * K. For num_std = 6 that's 4e-9 * K.
+
+  private:
+    WorkspaceBuffer values;
+    int num_threads = 0;
+    double top_rows[6] = {0};
+
+    void record_top_rows(int k, const double *v) {                      // called with each row k as it's completed
+      static const int start[3] = {5, 3, 0};
+      if (k <= 2)
+        std::copy(v, v + k + 1, top_rows + start[k]);
+    }
+
+    template <class Payoff>
+    void set_terminal(double seed, double logu, double logd, const Payoff &f);
+
+    void set_terminal_vanilla(double seed, double logu, double logd, const VanillaValueFromLog &f);
+    double RollbackVanilla(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, bool from_row = false, int stop_row = 0);
+    double RollbackWavefront(double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f, bool from_row, int stop_row);
+    double RollbackEUFromTerminal(double p, double q);
+    double TruncationBoundary(double seed, double logu, double logd, double disc, int k, int i, const VanillaValueFromLog &f);
 };
 
+template <class Payoff>
+void RollingLattice::set_terminal(double seed, double logu, double logd, const Payoff &f) {
+  if constexpr (std::is_base_of<VanillaValueFromLog, Payoff>::value) {
+    set_terminal_vanilla(seed, logu, logd, f);
+  } else {
+    int n = values.size();
+    double *v = values.data();
+    for (int i = 0; i < n; i++)
+      v[i] = f.eval(seed + i * logu + (n - 1 - i) * logd);
+  }
+}
+
+template <class Payoff>
+double RollingLattice::Rollback(double seed, double logu, double logd, double p, double q, const Payoff &f) {
+  if constexpr (std::is_base_of<VanillaValueFromLog, Payoff>::value) {
+    return RollbackVanilla(seed, logu, logd, p, q, f);
+  } else {
+    int n = values.size();
+    if (n == 0)
+      return 0;
+
+    set_terminal(seed, logu, logd, f);
+
+    double *v = values.data();
+    if (logu == -logd) {
+      // In a recombining lattice node i of row k sits at level 2i - k, with log value seed + (2i - k) * logu, so the
+      // intrinsic values only take 2n - 1 values, which are computed once.
+      WorkspaceBuffer levels(2 * n - 1);
+      for (int m = 0; m < 2 * n - 1; m++)
+        levels[m] = f.eval(seed + (m - (n - 1)) * logu);
+      for (int k = n - 2; k >= 0; k--) {
+        const double *intrinsic = levels.data() + (n - 1) - k;          //  intrinsic[2i] is the value at node i
+        for (int i = 0; i <= k; i++) {
+          double t1 = q * v[i] + p * v[i+1];
+          double t2 = intrinsic[2 * i];
+          v[i] = t1 > t2 ? t1 : t2;
+        }
+        record_top_rows(k, v);
+      }
+      return v[0];
+    }
+
+    for (int k = n - 2; k >= 0; k--) {
+      for (int i = 0; i <= k; i++) {
+        double t1 = q * v[i] + p * v[i+1];                              //  computes the evalue of the derivative
+        double t2 = f.eval(seed + i * logu + (k - i) * logd);           //  computes the the intrinsic value
+        v[i] = t1 > t2 ? t1 : t2;                                       //  sets value to the maximum of the two
+      }
+      record_top_rows(k, v);
+    }
+    return v[0];
+  }
+}
+
+template <class Payoff>
+double RollingLattice::RollbackEU(double seed, double logu, double logd, double p, double q, const Payoff &f) {
+  if (values.size() == 0)
+    return 0;
+
+  set_terminal(seed, logu, logd, f);
+  return RollbackEUFromTerminal(p, q);
+}
+
+// Returns the value of a European vanilla option on a lattice of N steps with the given parameters, the same value as
+// RollingLattice(N+1).RollbackEU(seed, logu, logd, p, q, f) up to rounding, in O(N) time instead of O(N^2): a European
+// payoff only needs the binomial sum
+//
+//    sum_i C(N, i) p^i q^(N-i) f(seed + i * logu + (N-i) * logd)
+//
+// taken over the nodes where f is non-zero. The weights are computed from that of the node closest to the mode, by
+// lgamma, and the ratios w(i+1)/w(i) = (N-i)/(i+1) * p/q going outwards, which keeps them accurate for any N. The sum
+// stops once the terms have become negligible.
+double EuropeanBinomialSum(long N, double seed, double logu, double logd, double p, double q, const VanillaValueFromLog &f);
+
 // This function implements a simple Monte Carlo average. Given a function f and integer M, it returns the average
 // value of f over M draws from normal distribution. The values are generated using the standard library.
- 
+//
+// Like the rollbacks above, this is a template on the type of f so that eval() can be inlined, and the version
+// taking a FunctionClass is kept for payoffs only known at runtime.
+
+template <class Payoff>
+double SimpleMC(const Payoff &f, long M) {
+    std::mt19937 gen;
+    std::normal_distribution<double> normdist(0,1);
+
+    gen.seed(12317);
+
+    double sum = 0;
+    for (long i = 0; i < M; i++) {
+	double x = normdist(gen);
+        sum += f.eval(x);
+	sum += f.eval(-x);  // corresponding to  the 'antithetic' path, for better performance
+    }
+    return sum / (2*M);
+}
+
 double SimpleMC(const FunctionClass &f, long M);
 
 // This function implements a simple Monte Carlo average. Given a functino f and integer M, it returns the average
 // value of f over M draws from a normal distribution. The values are generated using the boost library.
 //
+template <class Payoff>
+double SimpleMCUsingBoost(const Payoff &f, long M) {
+    boost::mt19937 gen;
+    boost::normal_distribution<> normdist(0,1);
+    
+    boost::variate_generator<boost::mt19937&, boost::normal_distribution<> > varnorm(gen, normdist);
+
+    double sum = 0;
+    for (long i = 0; i < M; i++) {
+	double x = varnorm();
+        sum += f.eval(x);
+	sum += f.eval(-x); 
+    }
+    return sum / (2*M);
+}
+
 double SimpleMCUsingBoost(const FunctionClass &f, long M);
 
+// The class Philox implements the counter-based random number generator Philox4x32-10 from the paper
+// "Parallel Random Numbers: As Easy as 1, 2, 3" by J. Salmon, M. Moraes, R. Dror and D. Shaw (2011).
+//
+// Instead of updating an internal state, the generator maps a 128-bit counter and a 64-bit key (the seed) to 128
+// random bits through ten rounds of a bijection. Any position of any stream can be computed directly, which makes
+// splitting the work between threads trivial: each block of samples just uses its own range of counters.
+
+class Philox {
+  public:
+    Philox(uint64_t seed);
+
+    void generate(uint64_t counter_lo, uint64_t counter_hi, uint32_t out[4]) const;
+    // Sets out to the four 32-bit words the generator associates to the counter (counter_lo, counter_hi).
+
+  private:
+    uint32_t key[2];
+};
+
+inline void Philox::generate(uint64_t counter_lo, uint64_t counter_hi, uint32_t out[4]) const {
+  uint32_t c0 = counter_lo, c1 = counter_lo >> 32, c2 = counter_hi, c3 = counter_hi >> 32;
+  uint32_t k0 = key[0], k1 = key[1];
+
+  for (int round = 0; round < 10; round++) {
+    uint64_t prod0 = (uint64_t) 0xD2511F53 * c0;
+    uint64_t prod1 = (uint64_t) 0xCD9E8D57 * c2;
+    uint32_t hi0 = prod0 >> 32, lo0 = prod0;
+    uint32_t hi1 = prod1 >> 32, lo1 = prod1;
+
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+
+    k0 += 0x9E3779B9;                                   // the Weyl sequence bumping the key between rounds
+    k1 += 0xBB67AE85;
+  }
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// The class ThreadPool keeps a set of worker threads around, so that parallel loops don't pay for starting threads
+// every time. There is a single pool for the whole process, and it is safe to use from several threads at once.
+
+class ThreadPool {
+  public:
+    static ThreadPool &instance(void);
+
+    void run(long num_tasks, int num_threads, const std::function<void(long)> &task);
+    // Calls task(0), ..., task(num_tasks-1), on at most num_threads threads (including the calling one), and
+    // returns when they're all done. The order in which the tasks run is not specified. num_threads <= 0 means
+    // one thread per core.
+
+    static int default_threads(void);
+
+    ~ThreadPool(void);
+
+  private:
+    struct Job;
+
+    std::vector<std::thread> workers;
+    std::deque<Job *> queue;             // one entry for every worker a job would like to have
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    bool stopping = false;
+
+    ThreadPool(void) {}
+    void work(void);
+    static void run_tasks(Job &job);
+};
+
+// This function is the parallel counterpart of SimpleMC(). It returns the average value of f over M draws from a
+// normal distribution and their antithetic counterparts, using num_threads threads (num_threads <= 0 means one per
+// core).
+//
+// The draws come from Philox streams derived from seed. They are split into blocks of mc_block draws, and block b
+// always uses the counters (i, b) for i = 0, 1, ..., whichever thread happens to compute it. Each block is generated
+// mc_chunk draws at a time by PhiloxNormalRow() and handed to f.eval_block(), so payoffs with a vectorized
+// eval_block() never go through one draw at a time. The block sums are then added up in order of b, so the result
+// only depends on f, M and seed: it is bit-for-bit the same for any number of threads, and any number of runs.
+
+const long mc_block = 1 << 16;
+const long mc_chunk = 1024;              // normals are generated and evaluated this many at a time (a multiple of 16)
+
+template <class Payoff>
+double ParallelMC(const Payoff &f, long M, int num_threads, uint64_t seed) {
+    if (M <= 0)
+      return 0;
+
+    long num_blocks = (M + mc_block - 1) / mc_block;
+    std::vector<double> block_sums(num_blocks);
+
+    ThreadPool::instance().run(num_blocks, num_threads, [&](long b) {
+      long count = b == num_blocks - 1 ? M - b * mc_block : mc_block;
+      double z[mc_chunk], y[mc_chunk];
+      double sum = 0;
+      for (long first = 0; first < count; first += mc_chunk) {
+        long n = std::min(mc_chunk, count - first);
+        PhiloxNormalRow(seed, b, first / 2, z, n);
+        f.eval_block(z, y, n);
+        for (long i = 0; i < n; i++)
+          sum += y[i];
+        for (long i = 0; i < n; i++)            // the antithetic paths, as in SimpleMC()
+          z[i] = -z[i];
+        f.eval_block(z, y, n);
+        for (long i = 0; i < n; i++)
+          sum += y[i];
+      }
+      block_sums[b] = sum;
+    });
+
+    double sum = 0;
+    for (double s: block_sums)
+      sum += s;
+    return sum / (2 * (double) M);
+}
+
+double ParallelMC(const FunctionClass &f, long M, int num_threads, uint64_t seed);
+
+// The result of a Monte Carlo estimate: the mean, its standard error, and the number of samples it was computed from.
+// The standard error is NaN when there are too few samples to estimate it, so that it never passes for converged.
+struct MCResult {
+  double mean = 0, std_error = std::numeric_limits<double>::quiet_NaN();
+  long count = 0;
+};
+
+// The running count, mean and sum of squared deviations from the mean of a set of samples. Samples are added in
+// batches: the mean and squared deviations of each batch are computed in two passes, and merged into the running
+// values with the update of Chan, Golub and LeVeque, so no precision is lost to the cancellation of a sum of squares.
+
+class MCAccumulator {
+  public:
+    void add(const double *x, long n);
+    void merge(const MCAccumulator &other);
+    MCResult result(void) const;
+    // The mean and the standard error of the mean, which is NaN with fewer than 2 samples.
+
+    long count = 0;
+    double mean = 0, m2 = 0;
+};
+
+// The Monte Carlo drivers below handle payoffs with several outputs per draw, such as a price and its sensitivities.
+// Such a payoff must have a method
+//
+//    void eval_outputs(const double *x, double *const *y, long n) const
+//
+// which sets y[k][j] to output k at the draw x[j], for 0 <= k < num_outputs and 0 <= j < n, with num_outputs at most
+// mc_max_outputs. Their samples are the averages of the outputs at the draws of ParallelMC() and at their antithetic
+// counterparts, so the standard errors they report account for the antithetic variates.
+
+const int mc_max_outputs = 4;
+
+// The accumulators of the outputs of a payoff, for ParallelMCBlocks(). Output k is added to acc[k].
+struct MCOutputAccumulators {
+  MCAccumulator acc[mc_max_outputs];
+
+  void add(const double *const *y, int num_outputs, long n) {
+    for (int k = 0; k < num_outputs; k++)
+      acc[k].add(y[k], n);
+  }
+  void merge(const MCOutputAccumulators &other) {
+    for (int k = 0; k < mc_max_outputs; k++)
+      acc[k].merge(other.acc[k]);
+  }
+};
+
+// Adds the samples of blocks first_block, ..., last_block - 1 of a run of M antithetic pairs to acc, in order of the
+// blocks. The blocks are split among num_threads threads as in ParallelMC(). Accumulator can be MCOutputAccumulators
+// or any class with the same add() and merge() methods, which is default constructible as empty.
+template <class Payoff, class Accumulator>
+void ParallelMCBlocks(const Payoff &f, int num_outputs, long M, long first_block, long last_block, int num_threads,
+                      uint64_t seed, Accumulator &acc) {
+    long num_blocks = last_block - first_block;
+    if (num_blocks <= 0)
+      return;
+    std::vector<Accumulator> block_acc(num_blocks);
+
+    ThreadPool::instance().run(num_blocks, num_threads, [&](long i) {
+      long b = first_block + i;
+      long count = std::min(mc_block, M - b * mc_block);
+      double z[mc_chunk], y[mc_max_outputs][mc_chunk], ya[mc_max_outputs][mc_chunk];
+      double *outputs[mc_max_outputs], *antithetic[mc_max_outputs];
+      for (int k = 0; k < mc_max_outputs; k++) {
+        outputs[k] = y[k];
+        antithetic[k] = ya[k];
+      }
+      for (long first = 0; first < count; first += mc_chunk) {
+        long n = std::min(mc_chunk, count - first);
+        PhiloxNormalRow(seed, b, first / 2, z, n);
+        f.eval_outputs(z, outputs, n);
+        for (long j = 0; j < n; j++)
+          z[j] = -z[j];
+        f.eval_outputs(z, antithetic, n);
+        for (int k = 0; k < num_outputs; k++)
+          for (long j = 0; j < n; j++)
+            y[k][j] = 0.5 * (y[k][j] + ya[k][j]);
+        block_acc[i].add(outputs, num_outputs, n);
+      }
+    });
+
+    for (long i = 0; i < num_blocks; i++)
+      acc.merge(block_acc[i]);
+}
+
+// Runs M antithetic pairs of draws through f, and sets result[k] to the estimate of output k. The result is
+// independent of the number of threads.
+template <class Payoff>
+void ParallelMCOutputs(const Payoff &f, int num_outputs, long M, int num_threads, uint64_t seed, MCResult *result) {
+    MCOutputAccumulators acc;
+    if (M > 0)
+      ParallelMCBlocks(f, num_outputs, M, 0, (M + mc_block - 1) / mc_block, num_threads, seed, acc);
+    for (int k = 0; k < num_outputs; k++)
+      result[k] = acc.acc[k].result();
+}
+
+// Returns the estimate of output 0 of f, sampling until its standard error is at most max(abs_tol, rel_tol * |mean|),
+// or until max_M antithetic pairs have been drawn. The draws are those of ParallelMCOutputs() with M = max_M, taken a
+// batch of blocks at a time. After each batch the number of pairs still needed is predicted from the current
+// variance, and the next batch covers it, with a margin, but is never larger than what has already been drawn. So
+// the result only depends on f, the tolerances, max_M and seed, and not on the number of threads. With both
+// tolerances 0, all max_M pairs are drawn.
+template <class Payoff>
+MCResult ParallelMCToTolerance(const Payoff &f, long max_M, double abs_tol, double rel_tol, int num_threads, uint64_t seed) {
+    MCOutputAccumulators outputs;
+    MCAccumulator &acc = outputs.acc[0];
+    long num_blocks = max_M > 0 ? (max_M + mc_block - 1) / mc_block : 0;
+    long done = 0;
+    long batch = (abs_tol > 0 || rel_tol > 0) ? 1 : num_blocks;
+
+    while (done < num_blocks) {
+      long last = std::min(num_blocks, done + batch);
+      ParallelMCBlocks(f, 1, max_M, done, last, num_threads, seed, outputs);
+      done = last;
+
+      MCResult r = acc.result();
+      double target = std::max(abs_tol, rel_tol * std::abs(r.mean));
+      if (acc.count < 2 || target <= 0) {
+        batch = num_blocks;
+        continue;
+      }
+      if (r.std_error <= target)
+        break;
+      double needed = acc.count * (r.std_error / target) * (r.std_error / target) * 1.1 - acc.count;
+      batch = std::min<double>(done, std::ceil(needed / mc_block));
+      batch = std::max(batch, 1L);
+    }
+    return acc.result();
+}
+
+// Control variates. A payoff with two outputs, the target Y and a control C whose expectation is known, gives the
+// estimator
+//
+//    mean(Y) - beta * (mean(C) - E[C])
+//
+// whose variance is smallest for beta = Cov(Y, C) / Var(C). The variance left is that of Y times 1 - rho^2, with rho
+// the correlation of Y and C. MCCovariance accumulates the means, variances and covariance of the two outputs, with
+// the same two-pass batches and pairwise merges as MCAccumulator, so beta can be estimated from the samples
+// themselves.
+
+class MCCovariance {
+  public:
+    void add(const double *const *y, int num_outputs, long n);
+    // Adds the samples (y[0][j], y[1][j]) for 0 <= j < n. num_outputs is only there for the interface of
+    // ParallelMCBlocks(), which always passes 2 here, and is ignored.
+    void merge(const MCCovariance &other);
+
+    MCResult controlled(double control_mean, double *beta = nullptr) const;
+    // The control variate estimate of E[Y] with beta estimated from the samples, and its standard error. If beta
+    // isn't null, it is set to the estimate.
+
+    long count = 0;
+    double mean[2] = {0, 0}, m2[2] = {0, 0}, c = 0;                    // c is the sum of the products of deviations
+};
+
+// Returns the control variate estimate of the mean of output 0 of f, using output 1, whose mean is control_mean, as
+// the control. The draws are those of ParallelMCOutputs(), and the result is again independent of the number of
+// threads.
+template <class Payoff>
+MCResult ParallelMCControlVariate(const Payoff &f, double control_mean, long M, int num_threads, uint64_t seed, double *beta = nullptr) {
+    MCCovariance acc;
+    if (M > 0)
+      ParallelMCBlocks(f, 2, M, 0, (M + mc_block - 1) / mc_block, num_threads, seed, acc);
+    return acc.controlled(control_mean, beta);
+}
+
+// Sampling the region where a payoff is non-zero. Many payoffs of a normal draw, such as those of vanilla and digital
+// options, vanish on one side of a threshold, and for options far out of the money almost every draw lands there and
+// is wasted. The two drivers below take the region {x: side * (x - threshold) > 0}, with side 1 or -1, where f may be
+// non-zero, and return estimates of E[f(Z)] for Z standard normal.
+
+// StratifiedMC() only samples the region: with P its probability, it splits the region into M strata of probability
+// P/M each, and takes one draw from each, uniform in probability within the stratum, so
+//
+//    E[f(Z)] ~ P/M * sum_i f(x_i)
+//
+// Every draw counts, and the stratification itself removes most of the variance of smooth payoffs. The standard error
+// is estimated by treating consecutive strata 2i and 2i+1 as one stratum with two draws, which slightly overestimates
+// it, so M should be even. The draws use the quantiles of the tail of the normal distribution on the side of the
+// region, which keeps them accurate however small P is. f only needs an eval_block() method. The result doesn't
+// depend on the number of threads.
+template <class Payoff>
+MCResult StratifiedMC(const Payoff &f, double threshold, double side, long M, int num_threads, uint64_t seed) {
+    MCResult result;
+    if (M <= 0)
+      return result;
+
+    double prob = 0.5 * std::erfc(side * threshold / std::sqrt(2.0));   // P(side * (Z - threshold) > 0)
+    Philox gen(seed);
+    long num_blocks = (M + mc_block - 1) / mc_block;
+    std::vector<double> block_sums(2 * num_blocks);
+
+    ThreadPool::instance().run(num_blocks, num_threads, [&](long b) {
+      long start = b * mc_block;
+      long count = std::min(mc_block, M - start);
+      double x[mc_chunk], y[mc_chunk];
+      double sum = 0, sum_sq = 0;
+      for (long first = 0; first < count; first += mc_chunk) {
+        long n = std::min(mc_chunk, count - first);
+        for (long j = 0; j < n; j += 4) {
+          uint32_t bits[4];
+          gen.generate((start + first + j) / 4, 0, bits);
+          for (long l = 0; l < 4 && j + l < n; l++) {
+            double jitter = (bits[l] + 0.5) * (1.0 / 4294967296.0);
+            x[j + l] = (start + first + j + l + jitter) / M * prob;   // the probability of the tail beyond the draw
+          }
+        }
+        InverseNormalRow(x, x, n);
+        for (long j = 0; j < n; j++)
+          x[j] = -side * x[j];
+        f.eval_block(x, y, n);
+        for (long j = 0; j < n; j++)
+          sum += y[j];
+        for (long j = 0; j + 1 < n; j += 2)
+          sum_sq += (y[j] - y[j + 1]) * (y[j] - y[j + 1]);
+      }
+      block_sums[2 * b] = sum;
+      block_sums[2 * b + 1] = sum_sq;
+    });
+
+    double sum = 0, sum_sq = 0;
+    for (long b = 0; b < num_blocks; b++) {
+      sum += block_sums[2 * b];
+      sum_sq += block_sums[2 * b + 1];
+    }
+    result.mean = prob * sum / M;
+    if (M > 1)
+      result.std_error = prob * std::sqrt(sum_sq) / M;
+    result.count = M;
+    return result;
+}
+
+// TiltedMC() samples the whole line, but from the normal distribution shifted by mu, typically to the threshold, so
+// that about half of the draws land in the region. Each draw x = z + mu is weighted by the likelihood ratio
+// exp(-mu * z - mu^2/2). The weight is only computed for the draws where f is non-zero, so the draws outside the
+// region cost no exponential. The draws z are those of ParallelMCOutputs(), with their antithetic counterparts.
+template <class Payoff>
+class TiltedPayoff {
+  public:
+    TiltedPayoff(const Payoff &f_, double mu_): f(f_), mu(mu_) {}
+    void eval_outputs(const double *z, double *const *y, long n) const {
+      double x[mc_chunk];
+      for (long j = 0; j < n; j++)
+        x[j] = z[j] + mu;
+      f.eval_block(x, y[0], n);
+      for (long j = 0; j < n; j++)
+        if (y[0][j] != 0)
+          y[0][j] *= std::exp(-mu * z[j] - 0.5 * mu * mu);
+    }
+  private:
+    const Payoff &f;
+    double mu;
+};
+
+template <class Payoff>
+MCResult TiltedMC(const Payoff &f, double mu, long M, int num_threads, uint64_t seed) {
+    MCResult result;
+    ParallelMCOutputs(TiltedPayoff<Payoff>(f, mu), 1, M, num_threads, seed, &result);
+    return result;
+}
+
+// Lets the drivers above run a FunctionClass, or any class with an eval_block() method, as a payoff with one output.
+template <class Payoff>
+class SingleOutput {
+  public:
+    explicit SingleOutput(const Payoff &f_): f(f_) {}
+    void eval_outputs(const double *x, double *const *y, long n) const { f.eval_block(x, y[0], n); }
+  private:
+    const Payoff &f;
+};
+
+MCResult ParallelMCToTolerance(const FunctionClass &f, long max_M, double abs_tol, double rel_tol, int num_threads, uint64_t seed);
+// The FunctionClass version of the above, with f wrapped in SingleOutput.
+
+// Quasi-Monte Carlo. The payoffs here are functions of a single normal draw, so the Sobol sequence reduces to its
+// first coordinate, the van der Corput sequence: point i is i with its 32 bits reversed, as a fraction of 2^32. The
+// first 2^m points of it (and of its scrambled versions) put exactly one point in each interval [k, k+1) / 2^m, which
+// is what makes the error of smooth payoffs decrease almost like 1/M instead of 1/sqrt(M).
+//
+// A randomized version of the sequence keeps that property while making each point uniformly distributed, so
+// independent randomizations give independent unbiased estimates, and their spread an error estimate:
+//
+//    DigitalShift: XOR every point with the same random 32-bit number.
+//    Owen:         nested uniform scrambling, where the flip of each bit depends on all the bits before it. This uses
+//                  the hash of S. Laine and T. Karras, as in "Practical Hash-based Owen Scrambling" (B. Burley, 2020).
+//                  For smooth integrands it converges faster than the digital shift.
+
+enum class Scrambling { None, DigitalShift, Owen };
+
+inline uint32_t ReverseBits(uint32_t x) {
+  x = (x >> 16) | (x << 16);
+  x = ((x & 0xFF00FF00) >> 8) | ((x & 0x00FF00FF) << 8);
+  x = ((x & 0xF0F0F0F0) >> 4) | ((x & 0x0F0F0F0F) << 4);
+  x = ((x & 0xCCCCCCCC) >> 2) | ((x & 0x33333333) << 2);
+  x = ((x & 0xAAAAAAAA) >> 1) | ((x & 0x55555555) << 1);
+  return x;
+}
+
+// Point i of the van der Corput sequence, randomized with the given scrambling and key
+inline uint32_t SobolPoint(uint32_t i, Scrambling scrambling, uint32_t key) {
+  switch (scrambling) {
+    case Scrambling::DigitalShift:
+      return ReverseBits(i) ^ key;
+    case Scrambling::Owen:
+      // The Laine-Karras hash only lets each bit depend on the bits below it, so it scrambles the reversed point.
+      i += key;
+      i ^= i * 0x6c50b47c;
+      i ^= i * 0xb82f1e52;
+      i ^= i * 0xc7afe638;
+      i ^= i * 0x8d22f6e6;
+      return ReverseBits(i);
+    default:
+      return ReverseBits(i);
+  }
+}
+
+// This function returns the average value of f over the points Phi^{-1}((x_i + 1/2) / 2^32), 0 <= i < M, of a
+// scrambled van der Corput sequence x_i, where Phi is the standard normal CDF. It does that for num_replicates
+// independent scramblings (whose keys come from a Philox stream with the given seed), and returns the mean of the
+// replicates. If std_error is not null, it is set to the standard error of that mean estimated from the spread of
+// the replicates: NaN with a single replicate, and 0 without scrambling, whose replicates all coincide. M should be
+// at most 2^32, and preferably a power of 2.
+//
+// The work is split as in ParallelMC(), in blocks of mc_block points per replicate, with the same guarantee: the
+// result doesn't depend on the number of threads.
+
+template <class Payoff>
+double SobolMC(const Payoff &f, long M, int num_replicates, Scrambling scrambling, int num_threads, uint64_t seed,
+               double *std_error = nullptr) {
+    if (std_error)
+      *std_error = std::numeric_limits<double>::quiet_NaN();
+    if (M <= 0 || num_replicates <= 0)
+      return 0;
+
+    Philox gen(seed);
+    long num_blocks = (M + mc_block - 1) / mc_block;
+    std::vector<double> block_sums(num_replicates * num_blocks);
+
+    ThreadPool::instance().run(num_replicates * num_blocks, num_threads, [&](long t) {
+      long r = t / num_blocks, b = t % num_blocks;
+      uint32_t bits[4];
+      gen.generate(r, 0, bits);
+
+      long start = b * mc_block;
+      long count = b == num_blocks - 1 ? M - start : mc_block;
+      double u[mc_chunk], y[mc_chunk];
+      double sum = 0;
+      for (long first = 0; first < count; first += mc_chunk) {
+        long n = std::min(mc_chunk, count - first);
+        for (long j = 0; j < n; j++)
+          u[j] = (SobolPoint(start + first + j, scrambling, bits[0]) + 0.5) * (1.0 / 4294967296.0);
+        InverseNormalRow(u, u, n);
+        f.eval_block(u, y, n);
+        for (long j = 0; j < n; j++)
+          sum += y[j];
+      }
+      block_sums[t] = sum;
+    });
+
+    std::vector<double> means(num_replicates, 0.0);
+    double mean = 0;
+    for (int r = 0; r < num_replicates; r++) {
+      for (long b = 0; b < num_blocks; b++)
+        means[r] += block_sums[r * num_blocks + b];
+      means[r] /= M;
+      mean += means[r];
+    }
+    mean /= num_replicates;
+
+    if (std_error && num_replicates > 1) {
+      double ss = 0;
+      for (double m: means)
+        ss += (m - mean) * (m - mean);
+      *std_error = sqrt(ss / (num_replicates - 1) / num_replicates);
+    }
+    return mean;
+}
+
+double SobolMC(const FunctionClass &f, long M, int num_replicates, Scrambling scrambling, int num_threads, uint64_t seed,
+               double *std_error = nullptr);
+
 
 #endif
@@ -0,0 +1,228 @@
+// author: Z. Amir-Khosravi
+//
+// Checks the fast pricing paths against the plain pricers they stand in for. Each check prints one line with the
+// largest discrepancy it found and its tolerance, and the program exits with status 1 if any of them fails.
+//
+// Build and run with "make check" in this directory.
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <random>
+
+#include "base.h"
+#include "pricing.h"
+#include "pde.h"
+
+static int failures = 0;
+
+static void report(const char *name, double error, double tolerance) {
+  bool ok = error <= tolerance;                                       //  false for NaN too
+  std::cout << (ok ? "ok    " : "FAIL  ") << name << ": " << error << " (tolerance " << tolerance << ")" << std::endl;
+  if (!ok)
+    failures++;
+}
+
+// The binomial models, with their plain pricers.
+struct ModelPricers {
+  LatticeModel model;
+  double (*call)(double, double, double, double, double, long);
+  double (*put)(double, double, double, double, double, long);
+};
+
+static const ModelPricers models[] = {
+  { LatticeModel::AdHoc, PriceAmericanCall, PriceAmericanPut },
+  { LatticeModel::Tian, PriceAmericanCall_Tian, PriceAmericanPut_Tian },
+  { LatticeModel::CRR, PriceAmericanCall_CRR, PriceAmericanPut_CRR },
+  { LatticeModel::Trigeorgis, PriceAmericanCall_Trig, PriceAmericanPut_Trig },
+  { LatticeModel::JarrowRudd, PriceAmericanCall_JR, PriceAmericanPut_JR },
+  { LatticeModel::JKY, PriceAmericanCall_JKY, PriceAmericanPut_JKY },
+};
+
+// A chain rollback gives the price of each strike on its own, up to rounding.
+static void check_chain(void) {
+  std::vector<double> strikes;
+  for (int j = 0; j < 37; j++)                                        //  not a multiple of the kernel width
+    strikes.push_back(60 + 2.5 * j);
+
+  double error = 0;
+  for (const ModelPricers &m: models) {
+    std::vector<double> calls = PriceAmericanCallChain(m.model, 100, 1.5, strikes, 0.03, 0.35, 500);
+    std::vector<double> puts = PriceAmericanPutChain(m.model, 100, 1.5, strikes, 0.03, 0.35, 500);
+    for (std::size_t j = 0; j < strikes.size(); j++) {
+      error = std::max(error, std::fabs(calls[j] - m.call(100, 1.5, strikes[j], 0.03, 0.35, 500)));
+      error = std::max(error, std::fabs(puts[j] - m.put(100, 1.5, strikes[j], 0.03, 0.35, 500)));
+    }
+  }
+  report("chain vs one strike at a time", error, 1e-9);
+}
+
+// A truncated rollback stays within the error bound it reports of the full one. The bound is loose, so the check
+// uses narrow bands, where the truncation error is well above rounding.
+static void check_truncated(void) {
+  double excess = -1e300;
+  for (const ModelPricers &m: models)
+    for (double num_std: {2.0, 3.0, 4.0, 6.0})
+      for (double strike: {70.0, 100.0, 140.0}) {
+        double bound;
+        double call = PriceAmericanCallTruncated(m.model, 100, 2, strike, 0.04, 0.5, 800, num_std, &bound);
+        excess = std::max(excess, std::fabs(call - m.call(100, 2, strike, 0.04, 0.5, 800)) - bound);
+        double put = PriceAmericanPutTruncated(m.model, 100, 2, strike, 0.04, 0.5, 800, num_std, &bound);
+        excess = std::max(excess, std::fabs(put - m.put(100, 2, strike, 0.04, 0.5, 800)) - bound);
+      }
+  report("truncated rollback error minus its bound", excess, 1e-9);
+}
+
+// The serial rollback of a vanilla payoff down to stop_row, written out with the kernels: the same computation as
+// RollingLattice below wavefront_rows rows. Returns the values of row stop_row.
+static std::vector<double> serial_rollback(long n, double seed, const LatticeStep &step, double strike, double sign, long stop_row) {
+  double dx = step.logu - step.logd;
+  std::vector<double> v(n), growth(n);
+  VanillaIntrinsicRow(v.data(), n, seed + (n - 1) * step.logd, dx, strike, sign);
+  for (long i = 0; i < n; i++)
+    growth[i] = i * dx;
+  ExpRow(growth.data(), growth.data(), n);
+  for (long k = n - 2; k >= stop_row; k--)
+    VanillaRollbackStepScaled(v.data(), k + 1, step.p, step.q, exp(seed + k * step.logd), growth.data(), strike, sign);
+  v.resize(stop_row + 1);
+  return v;
+}
+
+// The wavefront rollback of deep lattices gives the same bits as the serial one, for any number of threads, whether
+// it runs down to the root or stops at an earlier row.
+static void check_wavefront(void) {
+  const int w = RollingLattice::wavefront_rows;
+  int mismatches = 0;
+  for (long n: {w, w + RollingLattice::wavefront_tile + 3})
+    for (long stop_row: {0L, 1000L}) {
+      LatticeStep step = ModelStep(LatticeModel::CRR, 1, 0.05, 0.3, n - 1);
+      std::vector<double> reference = serial_rollback(n, log(100.0), step, 100, -1, stop_row);
+      for (int num_threads: {1, 3}) {
+        RollingLattice V(n);
+        V.set_num_threads(num_threads);
+        const double *row = V.RollbackToRow(log(100.0), step.logu, step.logd, step.p, step.q, PutValueFromLog(100), stop_row);
+        if (!std::equal(reference.begin(), reference.end(), row))
+          mismatches++;
+        if (stop_row == 0 && V.Rollback(log(100.0), step.logu, step.logd, step.p, step.q, PutValueFromLog(100)) != reference[0])
+          mismatches++;
+      }
+    }
+  report("wavefront vs serial rollback, mismatched results", mismatches, 0);
+}
+
+// The Monte Carlo Greeks don't depend on the number of threads, and with another seed they move by no more than
+// their standard errors allow. Each estimate is also checked against the Black-Scholes value, for all four payoffs.
+static void check_mc_greeks(void) {
+  typedef MCGreeks (*GreeksPricer)(double, double, double, double, double, long, int, uint64_t);
+  static const struct { GreeksPricer pricer; OptionType type; } payoffs[] = {
+    { PriceVanillaEuCallGreeks, OptionType::Call }, { PriceVanillaEuPutGreeks, OptionType::Put },
+    { PriceDigitalEuCallGreeks, OptionType::DigitalCall }, { PriceDigitalEuPutGreeks, OptionType::DigitalPut },
+  };
+
+  int mismatches = 0;
+  double worst = 0;                                                   //  the largest deviation in standard errors
+  for (auto &payoff: payoffs) {
+    MCGreeks one = payoff.pricer(100, 1, 105, 0.03, 0.25, 200000, 1, 12317);
+    MCGreeks three = payoff.pricer(100, 1, 105, 0.03, 0.25, 200000, 3, 12317);
+    MCGreeks other = payoff.pricer(100, 1, 105, 0.03, 0.25, 200000, 3, 4242);
+    BlackScholesGreeks exact = BlackScholes(payoff.type, 100, 1, 105, 0.03, 0.25);
+
+    const double a[4] = {one.price, one.delta, one.vega, one.rho};
+    const double b[4] = {three.price, three.delta, three.vega, three.rho};
+    const double c[4] = {other.price, other.delta, other.vega, other.rho};
+    const double a_error[4] = {one.price_error, one.delta_error, one.vega_error, one.rho_error};
+    const double c_error[4] = {other.price_error, other.delta_error, other.vega_error, other.rho_error};
+    const double e[4] = {exact.price, exact.delta, exact.vega, exact.rho};
+    for (int j = 0; j < 4; j++) {
+      if (a[j] != b[j])
+        mismatches++;
+      worst = std::max(worst, std::fabs(a[j] - c[j]) / std::hypot(a_error[j], c_error[j]));
+      worst = std::max(worst, std::fabs(a[j] - e[j]) / a_error[j]);
+    }
+  }
+  report("Monte Carlo Greeks with 1 vs 3 threads, mismatched results", mismatches, 0);
+  report("Monte Carlo Greeks across seeds and vs Black-Scholes, in standard errors", worst, 5);
+}
+
+// A ladder gives the plain price at spots on the nodes of its lattice up to rounding, since each node roots the same
+// N step lattice as the plain pricer, and between the nodes it stays within the lattice error.
+static void check_ladder(void) {
+  double node_error = 0, between_error = 0;
+  for (const ModelPricers &m: models) {
+    LatticeStep step = ModelStep(m.model, 1, 0.03, 0.3, 1000);
+    std::vector<double> nodes, between;
+    for (int k = -6; k <= 6; k++) {
+      nodes.push_back(100 * exp(k * (step.logu - step.logd)));
+      between.push_back(80 + 3.3 * (k + 6));
+    }
+    std::vector<double> calls = PriceAmericanCallLadder(m.model, nodes, 1, 100, 0.03, 0.3, 1000);
+    std::vector<double> puts = PriceAmericanPutLadder(m.model, nodes, 1, 100, 0.03, 0.3, 1000);
+    for (std::size_t a = 0; a < nodes.size(); a++) {
+      node_error = std::max(node_error, std::fabs(calls[a] - m.call(nodes[a], 1, 100, 0.03, 0.3, 1000)));
+      node_error = std::max(node_error, std::fabs(puts[a] - m.put(nodes[a], 1, 100, 0.03, 0.3, 1000)));
+    }
+    calls = PriceAmericanCallLadder(m.model, between, 1, 100, 0.03, 0.3, 1000);
+    puts = PriceAmericanPutLadder(m.model, between, 1, 100, 0.03, 0.3, 1000);
+    for (std::size_t a = 0; a < between.size(); a++) {
+      between_error = std::max(between_error, std::fabs(calls[a] - m.call(between[a], 1, 100, 0.03, 0.3, 1000)));
+      between_error = std::max(between_error, std::fabs(puts[a] - m.put(between[a], 1, 100, 0.03, 0.3, 1000)));
+    }
+  }
+  report("ladder vs plain prices at the nodes", node_error, 1e-9);
+  report("ladder vs plain prices between the nodes", between_error, 1e-2);
+}
+
+// Tracking the exercise boundary gives the same prices as comparing at every node, including for the steps where the
+// exercise region isn't a band: negative rates, and CRR with p > 1 on coarse lattices. Besides random cases, the check
+// covers a few that used to fail.
+static void check_boundary(void) {
+  struct Case { double spot, time_to_expiry, strike, rate, sigma; long N; };
+  std::vector<Case> cases = {
+    {177.8, 1.97, 32.43, -0.0315, 0.77, 5}, {45.79, 1.0475, 123.32, -0.0162, 0.899, 7}, {25.01, 2.96, 22.4, 0.135, 0.11, 2},
+  };
+  std::mt19937_64 rng(2024);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (int j = 0; j < 200; j++)
+    cases.push_back({10 + 190 * uniform(rng), 0.05 + 3 * uniform(rng), 10 + 190 * uniform(rng), -0.05 + 0.2 * uniform(rng),
+                     0.05 + 0.9 * uniform(rng), 1 + (long) (300 * uniform(rng))});
+
+  double error = 0;
+  for (const ModelPricers &m: models)
+    for (const Case &c: cases) {
+      double call = PriceAmericanCallBoundary(m.model, c.spot, c.time_to_expiry, c.strike, c.rate, c.sigma, c.N);
+      double put = PriceAmericanPutBoundary(m.model, c.spot, c.time_to_expiry, c.strike, c.rate, c.sigma, c.N);
+      error = std::max(error, std::fabs(call - m.call(c.spot, c.time_to_expiry, c.strike, c.rate, c.sigma, c.N)));
+      error = std::max(error, std::fabs(put - m.put(c.spot, c.time_to_expiry, c.strike, c.rate, c.sigma, c.N)));
+    }
+  report("boundary vs full rollback", error, 1e-9);
+}
+
+// The PDE prices agree with a deep CRR lattice up to the error of the two discretizations, and the two ways of
+// applying the exercise constraint agree with each other up to the convergence of the PSOR sweeps. Negative rates
+// make early exercise of calls worthwhile too.
+static void check_pde(void) {
+  double lattice_error = 0, method_error = 0;
+  for (double rate: {0.05, -0.02})
+    for (double strike: {80.0, 100.0, 125.0}) {
+      double call = PriceAmericanCallPDE(100, 1, strike, rate, 0.3, 800, 400);
+      double put = PriceAmericanPutPDE(100, 1, strike, rate, 0.3, 800, 400);
+      lattice_error = std::max(lattice_error, std::fabs(call - PriceAmericanCall_CRR(100, 1, strike, rate, 0.3, 4000)));
+      lattice_error = std::max(lattice_error, std::fabs(put - PriceAmericanPut_CRR(100, 1, strike, rate, 0.3, 4000)));
+      method_error = std::max(method_error, std::fabs(call - PriceAmericanCallPDE(100, 1, strike, rate, 0.3, 800, 400, ExerciseMethod::PSOR)));
+      method_error = std::max(method_error, std::fabs(put - PriceAmericanPutPDE(100, 1, strike, rate, 0.3, 800, 400, ExerciseMethod::PSOR)));
+    }
+  report("PDE vs CRR lattice", lattice_error, 2e-3);
+  report("PDE with PSOR vs Brennan-Schwartz", method_error, 1e-7);
+}
+
+int main(void) {
+  check_chain();
+  check_truncated();
+  check_wavefront();
+  check_mc_greeks();
+  check_ladder();
+  check_pde();
+  check_boundary();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,289 @@
+// author: Z. Amir-Khosravi
+//
+// This file compiles the kernels in kernels_impl.h for each supported instruction set, and picks one at runtime.
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <immintrin.h>
+
+#include "kernels.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+
+// GCC 12 warns about the deliberately undefined register _mm512_undefined_pd() uses inside the min/max intrinsics,
+// as -Wuninitialized or -Wmaybe-uninitialized depending on the optimization level.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+namespace avx512 {
+
+typedef __m512d vd;
+const int W = 8;
+
+inline vd set1(double x) { return _mm512_set1_pd(x); }
+inline vd loadu(const double *p) { return _mm512_loadu_pd(p); }
+inline void storeu(double *p, vd x) { _mm512_storeu_pd(p, x); }
+inline vd add(vd a, vd b) { return _mm512_add_pd(a, b); }
+inline vd sub(vd a, vd b) { return _mm512_sub_pd(a, b); }
+inline vd mul(vd a, vd b) { return _mm512_mul_pd(a, b); }
+inline vd fmadd(vd a, vd b, vd c) { return _mm512_fmadd_pd(a, b, c); }
+inline vd min(vd a, vd b) { return _mm512_min_pd(a, b); }
+inline vd max(vd a, vd b) { return _mm512_max_pd(a, b); }
+inline vd iota(void) { return _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0); }
+inline vd sqrt(vd a) { return _mm512_sqrt_pd(a); }
+inline vd div(vd a, vd b) { return _mm512_div_pd(a, b); }
+
+typedef __mmask8 vm;
+inline vm lt(vd a, vd b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+inline vd select(vm m, vd a, vd b) { return _mm512_mask_blend_pd(m, b, a); }      // m ? a : b, lane by lane
+inline bool any(vm m) { return m != 0; }
+
+typedef __m512i vi;
+inline vi iset1(uint64_t x) { return _mm512_set1_epi64(x); }
+inline vi iota64(void) { return _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0); }
+inline vi iadd(vi a, vi b) { return _mm512_add_epi64(a, b); }
+inline vi iand(vi a, vi b) { return _mm512_and_epi64(a, b); }
+inline vi ior(vi a, vi b) { return _mm512_or_epi64(a, b); }
+inline vi ixor(vi a, vi b) { return _mm512_xor_epi64(a, b); }
+inline vi imul32(vi a, vi b) { return _mm512_mul_epu32(a, b); }                     // full products of the low 32 bits
+inline vi ishr(vi a, int n) { return _mm512_srl_epi64(a, _mm_cvtsi32_si128(n)); }
+inline vi ishl(vi a, int n) { return _mm512_sll_epi64(a, _mm_cvtsi32_si128(n)); }
+inline vd as_double(vi a) { return _mm512_castsi512_pd(a); }
+inline vi as_int(vd a) { return _mm512_castpd_si512(a); }
+
+// Given t = 1.5 * 2^52 + n, returns 2^n by moving n + 1023 into the exponent bits.
+inline vd pow2(vd t) {
+  __m512i bits = _mm512_add_epi64(_mm512_castpd_si512(t), _mm512_set1_epi64(1023));
+  return _mm512_castsi512_pd(_mm512_slli_epi64(bits, 52));
+}
+
+#include "kernels_impl.h"
+
+}
+
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+namespace avx2 {
+
+typedef __m256d vd;
+const int W = 4;
+
+inline vd set1(double x) { return _mm256_set1_pd(x); }
+inline vd loadu(const double *p) { return _mm256_loadu_pd(p); }
+inline void storeu(double *p, vd x) { _mm256_storeu_pd(p, x); }
+inline vd add(vd a, vd b) { return _mm256_add_pd(a, b); }
+inline vd sub(vd a, vd b) { return _mm256_sub_pd(a, b); }
+inline vd mul(vd a, vd b) { return _mm256_mul_pd(a, b); }
+inline vd fmadd(vd a, vd b, vd c) { return _mm256_fmadd_pd(a, b, c); }
+inline vd min(vd a, vd b) { return _mm256_min_pd(a, b); }
+inline vd max(vd a, vd b) { return _mm256_max_pd(a, b); }
+inline vd iota(void) { return _mm256_set_pd(3, 2, 1, 0); }
+inline vd sqrt(vd a) { return _mm256_sqrt_pd(a); }
+inline vd div(vd a, vd b) { return _mm256_div_pd(a, b); }
+
+typedef __m256d vm;
+inline vm lt(vd a, vd b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+inline vd select(vm m, vd a, vd b) { return _mm256_blendv_pd(b, a, m); }
+inline bool any(vm m) { return _mm256_movemask_pd(m) != 0; }
+
+typedef __m256i vi;
+inline vi iset1(uint64_t x) { return _mm256_set1_epi64x(x); }
+inline vi iota64(void) { return _mm256_set_epi64x(3, 2, 1, 0); }
+inline vi iadd(vi a, vi b) { return _mm256_add_epi64(a, b); }
+inline vi iand(vi a, vi b) { return _mm256_and_si256(a, b); }
+inline vi ior(vi a, vi b) { return _mm256_or_si256(a, b); }
+inline vi ixor(vi a, vi b) { return _mm256_xor_si256(a, b); }
+inline vi imul32(vi a, vi b) { return _mm256_mul_epu32(a, b); }
+inline vi ishr(vi a, int n) { return _mm256_srl_epi64(a, _mm_cvtsi32_si128(n)); }
+inline vi ishl(vi a, int n) { return _mm256_sll_epi64(a, _mm_cvtsi32_si128(n)); }
+inline vd as_double(vi a) { return _mm256_castsi256_pd(a); }
+inline vi as_int(vd a) { return _mm256_castpd_si256(a); }
+
+inline vd pow2(vd t) {
+  __m256i bits = _mm256_add_epi64(_mm256_castpd_si256(t), _mm256_set1_epi64x(1023));
+  return _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+}
+
+#include "kernels_impl.h"
+
+}
+
+#pragma GCC pop_options
+
+namespace sse2 {
+
+typedef __m128d vd;
+const int W = 2;
+
+inline vd set1(double x) { return _mm_set1_pd(x); }
+inline vd loadu(const double *p) { return _mm_loadu_pd(p); }
+inline void storeu(double *p, vd x) { _mm_storeu_pd(p, x); }
+inline vd add(vd a, vd b) { return _mm_add_pd(a, b); }
+inline vd sub(vd a, vd b) { return _mm_sub_pd(a, b); }
+inline vd mul(vd a, vd b) { return _mm_mul_pd(a, b); }
+inline vd fmadd(vd a, vd b, vd c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }    // no FMA before AVX2
+inline vd min(vd a, vd b) { return _mm_min_pd(a, b); }
+inline vd max(vd a, vd b) { return _mm_max_pd(a, b); }
+inline vd iota(void) { return _mm_set_pd(1, 0); }
+inline vd sqrt(vd a) { return _mm_sqrt_pd(a); }
+inline vd div(vd a, vd b) { return _mm_div_pd(a, b); }
+
+typedef __m128d vm;
+inline vm lt(vd a, vd b) { return _mm_cmplt_pd(a, b); }
+inline vd select(vm m, vd a, vd b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+inline bool any(vm m) { return _mm_movemask_pd(m) != 0; }
+
+typedef __m128i vi;
+inline vi iset1(uint64_t x) { return _mm_set1_epi64x(x); }
+inline vi iota64(void) { return _mm_set_epi64x(1, 0); }
+inline vi iadd(vi a, vi b) { return _mm_add_epi64(a, b); }
+inline vi iand(vi a, vi b) { return _mm_and_si128(a, b); }
+inline vi ior(vi a, vi b) { return _mm_or_si128(a, b); }
+inline vi ixor(vi a, vi b) { return _mm_xor_si128(a, b); }
+inline vi imul32(vi a, vi b) { return _mm_mul_epu32(a, b); }
+inline vi ishr(vi a, int n) { return _mm_srl_epi64(a, _mm_cvtsi32_si128(n)); }
+inline vi ishl(vi a, int n) { return _mm_sll_epi64(a, _mm_cvtsi32_si128(n)); }
+inline vd as_double(vi a) { return _mm_castsi128_pd(a); }
+inline vi as_int(vd a) { return _mm_castpd_si128(a); }
+
+inline vd pow2(vd t) {
+  __m128i bits = _mm_add_epi64(_mm_castpd_si128(t), _mm_set1_epi64x(1023));
+  return _mm_castsi128_pd(_mm_slli_epi64(bits, 52));
+}
+
+#include "kernels_impl.h"
+
+}
+
+namespace {
+
+struct KernelTable {
+  const char *isa;
+  void (*intrinsic_row)(double *, long, double, double, double, double);
+  void (*rollback_step)(double *, long, long, double, double, double, double, double, double);
+  void (*european_step)(double *, long, double, double);
+  void (*exp_row)(const double *, double *, long);
+  void (*chain_intrinsic)(double *, long, long, const double *, const double *, double);
+  void (*chain_step)(double *, long, long, const double *, const double *, double, double, double);
+  void (*log_row)(const double *, double *, long);
+  void (*inverse_normal_row)(const double *, double *, long);
+  void (*philox_normal_row)(uint64_t, uint64_t, uint64_t, double *, long);
+  void (*lognormal_payoff_row)(const double *, double *, long, double, double, double, double, bool);
+  void (*normal_cdf_row)(const double *, double *, long);
+  void (*black_scholes_row)(long, const double *const *, const long *, double, bool, double *const *);
+  void (*rollback_step_scaled)(double *, long, double, double, double, const double *, double, double);
+  void (*exercise_row_scaled)(double *, long, double, const double *, double, double);
+};
+
+const KernelTable avx512_table = { "avx512", avx512::intrinsic_row, avx512::rollback_step, avx512::european_step, avx512::exp_row,
+                                  avx512::chain_intrinsic, avx512::chain_step, avx512::log_row, avx512::inverse_normal_row,
+                                  avx512::philox_normal_row, avx512::lognormal_payoff_row, avx512::normal_cdf_row,
+                                  avx512::black_scholes_row, avx512::rollback_step_scaled,
+                                  avx512::exercise_row_scaled };
+const KernelTable avx2_table = { "avx2", avx2::intrinsic_row, avx2::rollback_step, avx2::european_step, avx2::exp_row,
+                                  avx2::chain_intrinsic, avx2::chain_step, avx2::log_row, avx2::inverse_normal_row,
+                                  avx2::philox_normal_row, avx2::lognormal_payoff_row, avx2::normal_cdf_row,
+                                  avx2::black_scholes_row, avx2::rollback_step_scaled,
+                                  avx2::exercise_row_scaled };
+const KernelTable sse2_table = { "sse2", sse2::intrinsic_row, sse2::rollback_step, sse2::european_step, sse2::exp_row,
+                                  sse2::chain_intrinsic, sse2::chain_step, sse2::log_row, sse2::inverse_normal_row,
+                                  sse2::philox_normal_row, sse2::lognormal_payoff_row, sse2::normal_cdf_row,
+                                  sse2::black_scholes_row, sse2::rollback_step_scaled,
+                                  sse2::exercise_row_scaled };
+
+const KernelTable &select_kernels(void) {
+  __builtin_cpu_init();
+  bool has_avx512 = __builtin_cpu_supports("avx512f");
+  bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+  const char *forced = std::getenv("QTOOLS_SIMD");
+  if (forced != nullptr) {
+    if (std::strcmp(forced, "sse2") == 0)
+      return sse2_table;
+    if (std::strcmp(forced, "avx2") == 0 && has_avx2)
+      return avx2_table;
+  }
+
+  if (has_avx512)
+    return avx512_table;
+  if (has_avx2)
+    return avx2_table;
+  return sse2_table;
+}
+
+// The selection happens once, the first time it's needed; initialization of a static local is thread safe.
+const KernelTable &kernels(void) {
+  static const KernelTable &table = select_kernels();
+  return table;
+}
+
+}
+
+const char *KernelISA(void) {
+  return kernels().isa;
+}
+
+void VanillaIntrinsicRow(double *v, long n, double x0, double dx, double strike, double sign) {
+  kernels().intrinsic_row(v, n, x0, dx, strike, sign);
+}
+
+void VanillaRollbackStep(double *v, long n, long first, double p, double q, double x0, double dx, double strike, double sign) {
+  kernels().rollback_step(v, n, first, p, q, x0, dx, strike, sign);
+}
+
+void VanillaRollbackStepScaled(double *v, long n, double p, double q, double scale, const double *growth, double strike, double sign) {
+  kernels().rollback_step_scaled(v, n, p, q, scale, growth, strike, sign);
+}
+
+void VanillaExerciseRowScaled(double *v, long n, double scale, const double *growth, double strike, double sign) {
+  kernels().exercise_row_scaled(v, n, scale, growth, strike, sign);
+}
+
+void EuropeanRollbackStep(double *v, long n, double p, double q) {
+  kernels().european_step(v, n, p, q);
+}
+
+void ExpRow(const double *x, double *y, long n) {
+  kernels().exp_row(x, y, n);
+}
+
+void VanillaChainIntrinsic(double *v, long n, long width, const double *spots, const double *strikes, double sign) {
+  kernels().chain_intrinsic(v, n, width, spots, strikes, sign);
+}
+
+void VanillaChainStep(double *v, long n, long width, const double *spots, const double *strikes, double p, double q, double sign) {
+  kernels().chain_step(v, n, width, spots, strikes, p, q, sign);
+}
+
+void LogRow(const double *x, double *y, long n) {
+  kernels().log_row(x, y, n);
+}
+
+void InverseNormalRow(const double *u, double *z, long n) {
+  kernels().inverse_normal_row(u, z, n);
+}
+
+void PhiloxNormalRow(uint64_t seed, uint64_t stream, uint64_t counter, double *z, long n) {
+  kernels().philox_normal_row(seed, stream, counter, z, n);
+}
+
+void LogNormalPayoffRow(const double *z, double *y, long n, double a, double s, double strike, double sign, bool digital) {
+  kernels().lognormal_payoff_row(z, y, n, a, s, strike, sign, digital);
+}
+
+void NormalCDFRow(const double *x, double *y, long n) {
+  kernels().normal_cdf_row(x, y, n);
+}
+
+void BlackScholesRow(long n, const double *const inputs[5], const long strides[5], double sign, bool digital,
+                     double *const outputs[8]) {
+  kernels().black_scholes_row(n, inputs, strides, sign, digital, outputs);
+}
@@ -0,0 +1,108 @@
+// author: Z. Amir-Khosravi
+//
+// Declares vectorized kernels for the innermost loops of the lattice methods.
+//
+// Each kernel is compiled three times, for AVX-512, for AVX2 (with FMA) and for plain SSE2. The first time any kernel
+// is called, the best version supported by the CPU is picked and used from then on. Setting the environment variable
+// QTOOLS_SIMD to "avx512", "avx2" or "sse2" forces a particular version, which is useful for comparing them.
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstdint>
+
+// Returns the name of the instruction set the kernels are running on: "avx512", "avx2" or "sse2".
+const char *KernelISA(void);
+
+// Sets v[j] to the intrinsic value of a vanilla option at log value x0 + j*dx, for 0 <= j < n:
+//
+//    v[j] = max(sign * (exp(x0 + j*dx) - strike), 0)
+//
+// sign should be 1 for calls and -1 for puts.
+void VanillaIntrinsicRow(double *v, long n, double x0, double dx, double strike, double sign);
+
+// Performs one step of the American rollback in place, for 0 <= j < n:
+//
+//    v[j] = max(q * v[j] + p * v[j+1], sign * (exp(x0 + (first+j)*dx) - strike), 0)
+//
+// On entry v[0..n] holds entries first, ..., first+n of the next row of the lattice, on exit v[0..n-1] holds entries
+// first, ..., first+n-1 of the current one. Each entry only depends on first+j and the inputs, never on how the row
+// is split into calls, so rolling back a row in pieces gives exactly the same result as in one call.
+void VanillaRollbackStep(double *v, long n, long first, double p, double q, double x0, double dx, double strike, double sign);
+
+// Same as VanillaRollbackStep(), with the underlying at entry j given as scale * growth[j] instead of an exponential:
+//
+//    v[j] = max(q * v[j] + p * v[j+1], sign * (scale * growth[j] - strike), 0)
+//
+// In a lattice the underlying at node i of row k is exp(x0_k) * exp(i * dx), so a table of exp(i * dx) and one
+// exponential per row give all the nodes. The results differ from VanillaRollbackStep() by a few ulps of the
+// underlying.
+void VanillaRollbackStepScaled(double *v, long n, double p, double q, double scale, const double *growth, double strike, double sign);
+
+// Sets v[j] = sign * (scale * growth[j] - strike) for 0 <= j < n: the exercise values of the nodes of a row in the
+// exercise region, with the underlying given as in VanillaRollbackStepScaled(). Unlike the intrinsic value, this
+// isn't floored at 0.
+void VanillaExerciseRowScaled(double *v, long n, double scale, const double *growth, double strike, double sign);
+
+// Performs one step of the European rollback in place, v[j] = q * v[j] + p * v[j+1] for 0 <= j < n.
+void EuropeanRollbackStep(double *v, long n, double p, double q);
+
+// The chain kernels below work on an n x width matrix v stored row by row, where row i holds the values of node i
+// for each of width strikes, with spots[i] the value of the underlying at node i. width must be a multiple of 8.
+
+// Sets v[i][j] = max(sign * (spots[i] - strikes[j]), 0) for 0 <= i < n and 0 <= j < width.
+void VanillaChainIntrinsic(double *v, long n, long width, const double *spots, const double *strikes, double sign);
+
+// Performs one step of the American rollback for all strikes at once, in place, for 0 <= i < n and 0 <= j < width:
+//
+//    v[i][j] = max(q * v[i][j] + p * v[i+1][j], sign * (spots[i] - strikes[j]), 0)
+//
+// On entry rows 0..n hold the next row of the lattice, on exit rows 0..n-1 hold the current one.
+void VanillaChainStep(double *v, long n, long width, const double *spots, const double *strikes, double p, double q, double sign);
+
+// Computes exp(x[j]) for 0 <= j < n with the same vectorized exponential the kernels above use.
+// Accurate to about 1 ulp for x in [-708, 709]; arguments outside are clamped to that range.
+void ExpRow(const double *x, double *y, long n);
+
+// Computes log(x[j]) for 0 <= j < n, for positive normal x[j]. Accurate to about 1 ulp.
+void LogRow(const double *x, double *y, long n);
+
+// Sets z[j] to the inverse of the standard normal CDF at u[j], for 0 < u[j] < 1 and 0 <= j < n. This uses the
+// rational approximation of P. J. Acklam, whose relative error is below 1.15e-9: plenty for sampling, but not meant
+// for computing quantiles to full precision.
+void InverseNormalRow(const double *u, double *z, long n);
+
+// Fills z[0..n) with standard normal values from the Philox4x32-10 generator with the given seed (see Philox in
+// base.h). The counters (counter + 8g + l, stream) for 0 <= l < 8 give the values z[16g + l] (from their first 64
+// bits) and z[16g + 8 + l] (from the last 64), through uniforms with 52 random bits and InverseNormalRow(). So the
+// values are the same on every instruction set, up to rounding, and consecutive calls with counter increasing by
+// n/2 (n a multiple of 16) continue the same stream.
+void PhiloxNormalRow(uint64_t seed, uint64_t stream, uint64_t counter, double *z, long n);
+
+// Sets y[j] to the payoff of a vanilla or digital option on the underlying exp(a + s*z[j]), for 0 <= j < n:
+//
+//    vanilla:  y[j] = max(sign * (exp(a + s*z[j]) - strike), 0)
+//    digital:  y[j] = 1 if sign * (exp(a + s*z[j]) - strike) > 0, and 0 otherwise
+//
+// Draws far enough out of the money are recognized from z[j] alone, and skip the exponential.
+void LogNormalPayoffRow(const double *z, double *y, long n, double a, double s, double strike, double sign, bool digital);
+
+// Computes the standard normal CDF at x[j] for 0 <= j < n. The absolute error is around 1e-16, and the relative
+// error stays below 1e-8 even in the far tails.
+void NormalCDFRow(const double *x, double *y, long n);
+
+// Computes the Black-Scholes price and Greeks of n European options on an underlying without dividends: vanilla
+// options for digital false, and digital (cash-or-nothing, paying 1) ones for digital true, with sign 1 for calls
+// and -1 for puts. For 0 <= j < n, option j has
+//
+//    spot = inputs[0][j * strides[0]],  time to expiry = inputs[1][j * strides[1]],  strike = inputs[2][...],
+//    rate = inputs[3][...],  vol = inputs[4][...]
+//
+// so a stride of 0 gives all options the same value. Its price, delta, gamma, vega, theta, rho, vanna (the derivative
+// of delta with respect to vol) and volga (the second derivative with respect to vol) are written to outputs[0..7][j],
+// skipping outputs which are null. Theta is minus the derivative with respect to the time to expiry. Strides must be 0
+// or 1, and the time to expiry and vol must be positive.
+void BlackScholesRow(long n, const double *const inputs[5], const long strides[5], double sign, bool digital,
+                     double *const outputs[8]);
+
+#endif
@@ -0,0 +1,482 @@
+// author: Z. Amir-Khosravi
+//
+// Implements the kernels declared in kernels.h in terms of a handful of vector primitives.
+//
+// This file has no include guard on purpose: kernels.cc includes it once per instruction set, inside a namespace
+// that defines the vector type vd, its width W, and the primitives set1, loadu, storeu, add, sub, mul, div, sqrt,
+// fmadd, min, max, iota and pow2 (which builds 2^n from a vector of rounded values, see vexp below). It also defines
+// a comparison mask type vm with lt, select and any, and a vector type vi of W 64-bit integers, with iset1, iota64,
+// iadd, iand, ior, ixor, ishr, ishl, imul32 (the 64-bit product of the low 32 bits of each lane) and the bit casts
+// as_double and as_int.
+
+// Vectorized exp(x). The argument is split as x = n*log(2) + r with n an integer and |r| <= log(2)/2, exp(r) is
+// computed by its Taylor polynomial of degree 13 (truncation error below 1e-17), and the result is scaled by 2^n.
+// Rounding to the nearest integer uses the usual trick of adding and subtracting 1.5 * 2^52.
+inline vd vexp(vd x) {
+  const double magic = 6755399441055744.0;              // 1.5 * 2^52
+  const double log2e = 1.4426950408889634074;
+  const double ln2hi = 6.93147180369123816490e-01;      // log(2) split in two so that n * ln2hi is exact
+  const double ln2lo = 1.90821492927058770002e-10;
+
+  x = min(max(x, set1(-708.0)), set1(709.0));
+
+  vd t = fmadd(x, set1(log2e), set1(magic));
+  vd n = sub(t, set1(magic));
+  vd r = sub(x, mul(n, set1(ln2hi)));
+  r = sub(r, mul(n, set1(ln2lo)));
+
+  vd y = set1(1.0 / 6227020800.0);                      // 1/13!
+  y = fmadd(y, r, set1(1.0 / 479001600.0));
+  y = fmadd(y, r, set1(1.0 / 39916800.0));
+  y = fmadd(y, r, set1(1.0 / 3628800.0));
+  y = fmadd(y, r, set1(1.0 / 362880.0));
+  y = fmadd(y, r, set1(1.0 / 40320.0));
+  y = fmadd(y, r, set1(1.0 / 5040.0));
+  y = fmadd(y, r, set1(1.0 / 720.0));
+  y = fmadd(y, r, set1(1.0 / 120.0));
+  y = fmadd(y, r, set1(1.0 / 24.0));
+  y = fmadd(y, r, set1(1.0 / 6.0));
+  y = fmadd(y, r, set1(0.5));
+  y = fmadd(y, r, set1(1.0));
+  y = fmadd(y, r, set1(1.0));
+
+  return mul(y, pow2(t));
+}
+
+// max(sign * (exp(x) - strike), 0)
+inline vd vanilla_intrinsic(vd x, vd strike, vd sign) {
+  return max(mul(sign, sub(vexp(x), strike)), set1(0.0));
+}
+
+// The log values of the nodes j, ..., j+W-1
+inline vd node_logs(long j, vd x0, vd dx) {
+  return fmadd(add(set1((double) j), iota()), dx, x0);
+}
+
+// Each loop below handles the last n % W entries by copying them into a small zero-padded buffer and running one
+// more full-width iteration on it. That way every entry goes through exactly the same instructions, whatever its
+// position, so results never depend on how a row happens to be split.
+
+void intrinsic_row(double *v, long n, double x0, double dx, double strike, double sign) {
+  vd vx0 = set1(x0), vdx = set1(dx), vstrike = set1(strike), vsign = set1(sign);
+
+  long j = 0;
+  for (; j + W <= n; j += W)
+    storeu(v + j, vanilla_intrinsic(node_logs(j, vx0, vdx), vstrike, vsign));
+
+  if (j < n) {
+    double tail[W];
+    storeu(tail, vanilla_intrinsic(node_logs(j, vx0, vdx), vstrike, vsign));
+    for (long l = 0; j + l < n; l++)
+      v[j + l] = tail[l];
+  }
+}
+
+inline vd american_step(const double *v, long j, vd p, vd q, vd x0, vd dx, vd strike, vd sign) {
+  vd cont = fmadd(p, loadu(v + 1), mul(q, loadu(v)));  // the discounted expected value
+  return max(cont, vanilla_intrinsic(node_logs(j, x0, dx), strike, sign));
+}
+
+void rollback_step(double *v, long n, long first, double p, double q, double x0, double dx, double strike, double sign) {
+  vd vp = set1(p), vq = set1(q), vx0 = set1(x0), vdx = set1(dx), vstrike = set1(strike), vsign = set1(sign);
+
+  long j = 0;
+  for (; j + W <= n; j += W)                              // loads v[j..j+W] before storing v[j..j+W-1], so in place is fine
+    storeu(v + j, american_step(v + j, first + j, vp, vq, vx0, vdx, vstrike, vsign));
+
+  if (j < n) {
+    double tail[W + 1] = {0};
+    for (long l = 0; j + l <= n; l++)
+      tail[l] = v[j + l];
+    storeu(tail, american_step(tail, first + j, vp, vq, vx0, vdx, vstrike, vsign));
+    for (long l = 0; j + l < n; l++)
+      v[j + l] = tail[l];
+  }
+}
+
+inline vd american_step_scaled(const double *v, const double *growth, vd p, vd q, vd scale, vd strike, vd sign) {
+  vd cont = fmadd(p, loadu(v + 1), mul(q, loadu(v)));
+  return max(cont, max(mul(sign, sub(mul(scale, loadu(growth)), strike)), set1(0.0)));
+}
+
+void rollback_step_scaled(double *v, long n, double p, double q, double scale, const double *growth, double strike, double sign) {
+  vd vp = set1(p), vq = set1(q), vscale = set1(scale), vstrike = set1(strike), vsign = set1(sign);
+
+  long j = 0;
+  for (; j + W <= n; j += W)
+    storeu(v + j, american_step_scaled(v + j, growth + j, vp, vq, vscale, vstrike, vsign));
+
+  if (j < n) {
+    double tail[W + 1] = {0}, growth_tail[W] = {0};
+    for (long l = 0; j + l <= n; l++)
+      tail[l] = v[j + l];
+    for (long l = 0; j + l < n; l++)
+      growth_tail[l] = growth[j + l];
+    storeu(tail, american_step_scaled(tail, growth_tail, vp, vq, vscale, vstrike, vsign));
+    for (long l = 0; j + l < n; l++)
+      v[j + l] = tail[l];
+  }
+}
+
+void exercise_row_scaled(double *v, long n, double scale, const double *growth, double strike, double sign) {
+  vd vscale = set1(scale), vstrike = set1(strike), vsign = set1(sign);
+
+  long j = 0;
+  for (; j + W <= n; j += W)
+    storeu(v + j, mul(vsign, sub(mul(vscale, loadu(growth + j)), vstrike)));
+
+  if (j < n) {
+    double tail[W] = {0}, growth_tail[W] = {0};
+    for (long l = 0; j + l < n; l++)
+      growth_tail[l] = growth[j + l];
+    storeu(tail, mul(vsign, sub(mul(vscale, loadu(growth_tail)), vstrike)));
+    for (long l = 0; j + l < n; l++)
+      v[j + l] = tail[l];
+  }
+}
+
+void european_step(double *v, long n, double p, double q) {
+  vd vp = set1(p), vq = set1(q);
+
+  long j = 0;
+  for (; j + W <= n; j += W)
+    storeu(v + j, fmadd(vp, loadu(v + j + 1), mul(vq, loadu(v + j))));
+
+  if (j < n) {
+    double tail[W + 1] = {0};
+    for (long l = 0; j + l <= n; l++)
+      tail[l] = v[j + l];
+    storeu(tail, fmadd(vp, loadu(tail + 1), mul(vq, loadu(tail))));
+    for (long l = 0; j + l < n; l++)
+      v[j + l] = tail[l];
+  }
+}
+
+void chain_intrinsic(double *v, long n, long width, const double *spots, const double *strikes, double sign) {
+  vd vsign = set1(sign);
+  for (long i = 0; i < n; i++) {
+    vd spot = set1(spots[i]);
+    double *row = v + i * width;
+    for (long j = 0; j < width; j += W)
+      storeu(row + j, max(mul(vsign, sub(spot, loadu(strikes + j))), set1(0.0)));
+  }
+}
+
+void chain_step(double *v, long n, long width, const double *spots, const double *strikes, double p, double q, double sign) {
+  vd vp = set1(p), vq = set1(q), vsign = set1(sign);
+  for (long i = 0; i < n; i++) {
+    vd spot = set1(spots[i]);
+    double *row = v + i * width;
+    const double *next = row + width;
+    for (long j = 0; j < width; j += W) {
+      vd cont = fmadd(vp, loadu(next + j), mul(vq, loadu(row + j)));
+      vd intrinsic = max(mul(vsign, sub(spot, loadu(strikes + j))), set1(0.0));
+      storeu(row + j, max(cont, intrinsic));
+    }
+  }
+}
+
+void exp_row(const double *x, double *y, long n) {
+  long j = 0;
+  for (; j + W <= n; j += W)
+    storeu(y + j, vexp(loadu(x + j)));
+
+  if (j < n) {
+    double tail[W] = {0};
+    for (long l = 0; j + l < n; l++)
+      tail[l] = x[j + l];
+    storeu(tail, vexp(loadu(tail)));
+    for (long l = 0; j + l < n; l++)
+      y[j + l] = tail[l];
+  }
+}
+
+// Applies the vector function f to x[0..n), writing the results to y[0..n). x and y may be the same array.
+template <class F>
+inline void map_row(const double *x, double *y, long n, F f) {
+  long j = 0;
+  for (; j + W <= n; j += W)
+    storeu(y + j, f(loadu(x + j)));
+
+  if (j < n) {
+    double tail[W] = {0};
+    for (long l = 0; j + l < n; l++)
+      tail[l] = x[j + l];
+    storeu(tail, f(loadu(tail)));
+    for (long l = 0; j + l < n; l++)
+      y[j + l] = tail[l];
+  }
+}
+
+// Vectorized log(x) for positive normal x. With x = m * 2^e and sqrt(1/2) <= m < sqrt(2), log(m) = 2*atanh(f) for
+// f = (m-1)/(m+1), and |f| < 0.1716 so the odd series of atanh up to f^23 is good to below 1e-17.
+inline vd vlog(vd x) {
+  const double ln2hi = 6.93147180369123816490e-01;
+  const double ln2lo = 1.90821492927058770002e-10;
+
+  vi bits = as_int(x);
+  vd e = as_double(ior(ishr(bits, 52), iset1(0x4330000000000000)));     // 2^52 + the biased exponent
+  e = sub(e, set1(4503599627370496.0 + 1023));
+  vd m = as_double(ior(iand(bits, iset1(0x000FFFFFFFFFFFFF)), iset1(0x3FF0000000000000)));
+
+  vm big = lt(set1(1.41421356237309504880), m);
+  m = select(big, mul(m, set1(0.5)), m);
+  e = select(big, add(e, set1(1.0)), e);
+
+  vd f = div(sub(m, set1(1.0)), add(m, set1(1.0)));
+  vd f2 = mul(f, f);
+  vd y = set1(1.0 / 23);
+  for (int k = 21; k >= 1; k -= 2)
+    y = fmadd(y, f2, set1(1.0 / k));
+
+  return fmadd(e, set1(ln2hi), fmadd(e, set1(ln2lo), mul(add(f, f), y)));
+}
+
+// Vectorized inverse of the standard normal CDF, by Acklam's approximation: a rational function of u - 1/2 in the
+// central region, and of sqrt(-2 log(u)) (or of 1-u) in the tails. Every lane computes the central value and the tail
+// values are only computed when some lane needs them, which happens for about 5% of uniform samples.
+inline vd inverse_normal(vd u) {
+  const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                       1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+  const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                       6.680131188771972e+01, -1.328068155288572e+01};
+  const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                       -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+  const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00};
+
+  vd q = sub(u, set1(0.5));
+  vd r = mul(q, q);
+  vd num = set1(a[0]), den = set1(b[0]);
+  for (int k = 1; k < 6; k++)
+    num = fmadd(num, r, set1(a[k]));
+  for (int k = 1; k < 5; k++)
+    den = fmadd(den, r, set1(b[k]));
+  den = fmadd(den, r, set1(1.0));
+  vd z = div(mul(num, q), den);
+
+  vd pm = min(u, sub(set1(1.0), u));
+  vm tail = lt(pm, set1(0.02425));
+  if (any(tail)) {
+    vd t = sqrt(mul(set1(-2.0), vlog(pm)));
+    vd tnum = set1(c[0]), tden = set1(d[0]);
+    for (int k = 1; k < 6; k++)
+      tnum = fmadd(tnum, t, set1(c[k]));
+    for (int k = 1; k < 4; k++)
+      tden = fmadd(tden, t, set1(d[k]));
+    tden = fmadd(tden, t, set1(1.0));
+    vd zt = div(tnum, tden);                                        // the lower tail value, which is negative
+    zt = select(lt(u, set1(0.5)), zt, sub(set1(0.0), zt));
+    z = select(tail, zt, z);
+  }
+  return z;
+}
+
+// Philox4x32-10 (see the class Philox in base.h) on the W counters (counter_lo + l, counter_hi), 0 <= l < W. Each
+// 32-bit word is kept in the low half of a 64-bit lane, which is what imul32 works on.
+inline void philox(vi counter_lo, uint64_t counter_hi, uint32_t k0, uint32_t k1, vi out[4]) {
+  const vi low32 = iset1(0xFFFFFFFF);
+  const vi m0 = iset1(0xD2511F53), m1 = iset1(0xCD9E8D57);
+  vi c0 = iand(counter_lo, low32), c1 = ishr(counter_lo, 32);
+  vi c2 = iset1((uint32_t) counter_hi), c3 = iset1(counter_hi >> 32);
+
+  for (int round = 0; round < 10; round++) {
+    vi prod0 = imul32(m0, c0);
+    vi prod1 = imul32(m1, c2);
+    vi next0 = ixor(ixor(ishr(prod1, 32), c1), iset1(k0));
+    vi next2 = ixor(ixor(ishr(prod0, 32), c3), iset1(k1));
+    c1 = iand(prod1, low32);
+    c3 = iand(prod0, low32);
+    c0 = next0;
+    c2 = next2;
+
+    k0 += 0x9E3779B9;
+    k1 += 0xBB67AE85;
+  }
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// The uniform (2k+1) / 2^53 in (0,1), where k is made of the top 32 bits of hi and the top 20 bits of lo. Going
+// through the bits of 1 + k / 2^52 avoids converting 64-bit integers, which SSE2 and AVX2 can't do.
+inline vd uniform(vi hi, vi lo) {
+  vi k = ior(ishl(hi, 20), ishr(lo, 12));
+  vd one_k = as_double(ior(k, iset1(0x3FF0000000000000)));
+  return add(sub(one_k, set1(1.0)), set1(1.0 / 9007199254740992.0));
+}
+
+// Fills u[0..16) with the uniforms of the counters (counter + l, stream), 0 <= l < 8, as described in kernels.h
+inline void philox_uniforms(double *u, uint64_t counter, uint64_t stream, uint32_t k0, uint32_t k1) {
+  for (long l = 0; l < 8; l += W) {
+    vi out[4];
+    philox(iadd(iset1(counter + l), iota64()), stream, k0, k1, out);
+    storeu(u + l, uniform(out[0], out[1]));
+    storeu(u + 8 + l, uniform(out[2], out[3]));
+  }
+}
+
+void log_row(const double *x, double *y, long n) {
+  map_row(x, y, n, vlog);
+}
+
+void inverse_normal_row(const double *u, double *z, long n) {
+  map_row(u, z, n, inverse_normal);
+}
+
+void philox_normal_row(uint64_t seed, uint64_t stream, uint64_t counter, double *z, long n) {
+  uint32_t k0 = seed, k1 = seed >> 32;
+
+  long j = 0;
+  for (; j + 16 <= n; j += 16)
+    philox_uniforms(z + j, counter + j / 2, stream, k0, k1);
+
+  if (j < n) {
+    double tail[16];
+    philox_uniforms(tail, counter + j / 2, stream, k0, k1);
+    for (long l = 0; j + l < n; l++)
+      z[j + l] = tail[l];
+  }
+
+  map_row(z, z, n, inverse_normal);
+}
+
+// The payoff is 0 unless sign * (x - threshold) > 0, with threshold = (log(strike) - a) / s. Vectors of draws that are
+// all beyond the threshold by some margin, so that rounding can't matter, skip the exponential and are set to 0.
+void lognormal_payoff_row(const double *z, double *y, long n, double a, double s, double strike, double sign, bool digital) {
+  vd va = set1(a), vs = set1(s), vstrike = set1(strike), vsign = set1(sign), zero = set1(0.0);
+
+  bool skip = strike > 0 && s > 0;
+  double threshold = skip ? (std::log(strike) - a) / s : 0;
+  vd vthreshold = set1(threshold), margin = set1(-1e-9 * (1 + std::fabs(threshold)));
+  auto all_out = [&](vd x) { return skip && !any(lt(margin, mul(vsign, sub(x, vthreshold)))); };
+
+  if (digital)
+    map_row(z, y, n, [&](vd x) {
+      if (all_out(x))
+        return zero;
+      vd v = mul(vsign, sub(vexp(fmadd(vs, x, va)), vstrike));
+      return select(lt(zero, v), set1(1.0), zero);
+    });
+  else
+    map_row(z, y, n, [&](vd x) {
+      if (all_out(x))
+        return zero;
+      return max(mul(vsign, sub(vexp(fmadd(vs, x, va)), vstrike)), zero);
+    });
+}
+
+// Vectorized standard normal CDF, by Hart's algorithm 5666 as given in "Better approximations to cumulative normal
+// functions" (G. West, 2005): a rational function of |x| times exp(-x^2/2) up to |x| = 7.07, and a continued
+// fraction beyond. The absolute error is around 1e-16, and the relative error stays below 1e-8 in the far tails.
+// Also sets pdf to the normal density at x.
+inline vd normal_cdf(vd x, vd &pdf) {
+  const double num_coeffs[7] = {3.52624965998911e-02, 0.700383064443688, 6.37396220353165, 33.912866078383,
+                                112.079291497871, 221.213596169931, 220.206867912376};
+  const double den_coeffs[8] = {8.83883476483184e-02, 1.75566716318264, 16.064177579207, 86.7807322029461,
+                                296.564248779674, 637.333633378831, 793.826512519948, 440.413735824752};
+
+  vd zero = set1(0.0);
+  vd ax = max(x, sub(zero, x));
+  vd e = vexp(mul(set1(-0.5), mul(ax, ax)));
+  pdf = mul(e, set1(0.39894228040143267794));          // 1/sqrt(2 pi)
+
+  vd num = set1(num_coeffs[0]), den = set1(den_coeffs[0]);
+  for (int k = 1; k < 7; k++)
+    num = fmadd(num, ax, set1(num_coeffs[k]));
+  for (int k = 1; k < 8; k++)
+    den = fmadd(den, ax, set1(den_coeffs[k]));
+  vd c = div(mul(e, num), den);
+
+  vd cf = add(ax, set1(0.65));
+  for (int k = 4; k >= 1; k--)
+    cf = add(ax, div(set1((double) k), cf));
+  vd c_far = div(e, mul(cf, set1(2.506628274631)));
+
+  c = select(lt(ax, set1(7.07106781186547)), c, c_far);
+  c = select(lt(ax, set1(37.0)), c, zero);              // c is the CDF at -|x|
+  return select(lt(zero, x), sub(set1(1.0), c), c);
+}
+
+inline vd normal_cdf_only(vd x) {
+  vd pdf;
+  return normal_cdf(x, pdf);
+}
+
+void normal_cdf_row(const double *x, double *y, long n) {
+  map_row(x, y, n, normal_cdf_only);
+}
+
+// The Black-Scholes value and Greeks of W options, see BlackScholesRow() in kernels.h. in[] holds spot, time to
+// expiry, strike, rate and vol; out[] gets the price, delta, gamma, vega, theta, rho, vanna and volga.
+inline void black_scholes(const vd in[5], vd s, bool digital, vd out[8]) {
+  vd spot = in[0], t = in[1], strike = in[2], rate = in[3], vol = in[4];
+  vd zero = set1(0.0), half = set1(0.5);
+
+  vd sqrt_t = sqrt(t);
+  vd vol_sqrt_t = mul(vol, sqrt_t);
+  vd d1 = div(fmadd(fmadd(mul(half, vol), vol, rate), t, vlog(div(spot, strike))), vol_sqrt_t);
+  vd d2 = sub(d1, vol_sqrt_t);
+  vd df = vexp(sub(zero, mul(rate, t)));
+
+  vd n1, n2;
+  vd cdf1 = normal_cdf(mul(s, d1), n1);
+  vd cdf2 = normal_cdf(mul(s, d2), n2);
+
+  if (!digital) {
+    vd kdf = mul(strike, df);
+    vd vega = mul(mul(spot, n1), sqrt_t);
+    out[0] = mul(s, sub(mul(spot, cdf1), mul(kdf, cdf2)));
+    out[1] = mul(s, cdf1);
+    out[2] = div(n1, mul(spot, vol_sqrt_t));
+    out[3] = vega;
+    out[4] = sub(zero, add(div(mul(mul(spot, n1), vol), add(sqrt_t, sqrt_t)), mul(mul(s, rate), mul(kdf, cdf2))));
+    out[5] = mul(s, mul(mul(kdf, t), cdf2));
+    out[6] = sub(zero, div(mul(n1, d2), vol));
+    out[7] = div(mul(vega, mul(d1, d2)), vol);
+  } else {
+    vd sdn2 = mul(s, mul(df, n2));
+    vd vol2 = mul(vol, vol);
+    out[0] = mul(df, cdf2);
+    out[1] = div(sdn2, mul(spot, vol_sqrt_t));
+    out[2] = sub(zero, div(mul(sdn2, d1), mul(mul(spot, spot), mul(vol2, t))));
+    out[3] = sub(zero, div(mul(sdn2, d1), vol));
+    out[4] = sub(mul(rate, out[0]), mul(sdn2, sub(div(rate, vol_sqrt_t), div(d1, add(t, t)))));
+    out[5] = add(mul(sub(zero, t), out[0]), div(mul(sdn2, sqrt_t), vol));
+    out[6] = div(mul(sdn2, fmadd(d1, d2, set1(-1.0))), mul(mul(spot, vol2), sqrt_t));
+    out[7] = div(mul(sdn2, sub(add(d1, d2), mul(mul(d1, d1), d2))), vol2);
+  }
+}
+
+void black_scholes_row(long n, const double *const inputs[5], const long strides[5], double sign, bool digital,
+                       double *const outputs[8]) {
+  vd s = set1(sign);
+  for (long j = 0; j < n; j += W) {
+    long m = n - j < W ? n - j : W;
+    vd in[5], out[8];
+    for (int a = 0; a < 5; a++) {
+      if (strides[a] == 0)
+        in[a] = set1(inputs[a][0]);
+      else if (m == W)
+        in[a] = loadu(inputs[a] + j);
+      else {
+        double tail[W];
+        for (long l = 0; l < W; l++)
+          tail[l] = l < m ? inputs[a][j + l] : 1.0;     // padding with 1 keeps the unused lanes finite
+        in[a] = loadu(tail);
+      }
+    }
+
+    black_scholes(in, s, digital, out);
+
+    for (int a = 0; a < 8; a++) {
+      if (!outputs[a])
+        continue;
+      if (m == W)
+        storeu(outputs[a] + j, out[a]);
+      else {
+        double tail[W];
+        storeu(tail, out[a]);
+        for (long l = 0; l < m; l++)
+          outputs[a][j + l] = tail[l];
+      }
+    }
+  }
+}
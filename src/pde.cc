@@ -0,0 +1,173 @@
+// author: Z. Amir-Khosravi
+//
+// Implements the Crank-Nicolson solver declared in pde.h.
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "pde.h"
+#include "pricing.h"
+
+namespace {
+
+// The tridiagonal systems have constant coefficients: sub * V[j-1] + diag * V[j] + super * V[j+1] = rhs[j] for the
+// interior nodes 1 <= j <= m-1, with V[0] and V[m] given. The solvers write the solution to v[1..m-1], and use work
+// for the eliminated diagonal.
+
+struct Tridiagonal {
+  double sub, diag, super;
+};
+
+// The Thomas algorithm, eliminating the subdiagonal from j = 1 upwards, then substituting back downwards. If
+// floor isn't null, each value is raised to floor[j] as it's computed: that's the Brennan-Schwartz solve for an
+// exercise region at the upper end of the grid.
+void solve_up(const Tridiagonal &A, double *v, const double *rhs, double *work, long m, const double *floor) {
+  work[1] = A.diag;
+  v[1] = rhs[1] - A.sub * v[0];                                       //  v holds the eliminated right hand sides
+  for (long j = 2; j <= m - 1; j++) {
+    double l = A.sub / work[j - 1];
+    work[j] = A.diag - l * A.super;
+    v[j] = rhs[j] - l * v[j - 1];
+  }
+  v[m - 1] -= A.super * v[m];
+
+  v[m - 1] /= work[m - 1];
+  if (floor)
+    v[m - 1] = std::max(v[m - 1], floor[m - 1]);
+  for (long j = m - 2; j >= 1; j--) {
+    v[j] = (v[j] - A.super * v[j + 1]) / work[j];
+    if (floor)
+      v[j] = std::max(v[j], floor[j]);
+  }
+}
+
+// The same, eliminating the superdiagonal from j = m-1 downwards and substituting back upwards: the Brennan-Schwartz
+// solve for an exercise region at the lower end of the grid.
+void solve_down(const Tridiagonal &A, double *v, const double *rhs, double *work, long m, const double *floor) {
+  work[m - 1] = A.diag;
+  v[m - 1] = rhs[m - 1] - A.super * v[m];
+  for (long j = m - 2; j >= 1; j--) {
+    double l = A.super / work[j + 1];
+    work[j] = A.diag - l * A.sub;
+    v[j] = rhs[j] - l * v[j + 1];
+  }
+  v[1] -= A.sub * v[0];
+
+  v[1] /= work[1];
+  if (floor)
+    v[1] = std::max(v[1], floor[1]);
+  for (long j = 2; j <= m - 1; j++) {
+    v[j] = (v[j] - A.sub * v[j - 1]) / work[j];
+    if (floor)
+      v[j] = std::max(v[j], floor[j]);
+  }
+}
+
+// Projected SOR, starting from the values already in v, which at each step are those of the previous one. The
+// relaxation factor is the optimal one for the unconstrained system, 2 / (1 + sqrt(1 - rho^2)) with rho the spectral
+// radius of the Jacobi iteration, which makes the number of sweeps grow like m rather than m^2 on fine grids. Returns
+// false if the sweeps haven't converged after the cap, which also grows with m.
+bool solve_psor(const Tridiagonal &A, double *v, const double *rhs, long m, const double *floor) {
+  double rho = A.sub * A.super > 0 ? 2 * sqrt(A.sub * A.super) / A.diag * cos(M_PI / m) : 0;
+  double omega = rho < 1 ? 2 / (1 + sqrt(1 - rho * rho)) : 1;
+  long max_sweeps = std::max(1000L, 20 * m);
+
+  double scale = 0;
+  for (long j = 1; j <= m - 1; j++)
+    scale = std::max(scale, std::fabs(rhs[j]));
+  // With the optimal factor the error shrinks by about omega - 1 per sweep, so the error left when the sweeps stop
+  // is about change / (2 - omega), and it adds up over the time steps. The tolerance allows for both, but stays a few
+  // roundings above 0 so that the sweeps can meet it.
+  double tolerance = std::max(1e-13 * (2 - omega), 1e-15) * std::max(scale, 1.0);
+
+  for (long sweep = 0; sweep < max_sweeps; sweep++) {
+    double change = 0;
+    for (long j = 1; j <= m - 1; j++) {
+      double gs = (rhs[j] - A.sub * v[j - 1] - A.super * v[j + 1]) / A.diag;
+      double x = std::max(v[j] + omega * (gs - v[j]), floor[j]);
+      change = std::max(change, std::fabs(x - v[j]));
+      v[j] = x;
+    }
+    if (change < tolerance)
+      return true;
+  }
+  return false;
+}
+
+}
+
+double SolveBlackScholesPDE(const VanillaValueFromLog &f, double spot, double time_to_expiry, double rate, double vol,
+                            long num_space, long num_time, bool american, ExerciseMethod method, PDEGrid *grid) {
+  long m = std::max(2L, num_space + (num_space & 1));                  //  even, so that log(spot) is the middle node
+  long steps = std::max(2L, num_time);
+  double strike = f.get_strike(), sign = f.get_sign();
+
+  double x0 = log(spot);
+  double half_width = std::max(pde_num_std * vol * sqrt(time_to_expiry), 1.5 * std::fabs(log(strike) - x0));
+  half_width = std::max(half_width, 1e-3);
+  double dx = 2 * half_width / m;
+  double dt = time_to_expiry / steps;
+
+  WorkspaceBuffer x(m + 1), intrinsic(m + 1), v(m + 1), rhs(m + 1), work(m + 1);
+  for (long j = 0; j <= m; j++)
+    x[j] = x0 + (j - m / 2) * dx;
+  f.eval_block(x.data(), intrinsic.data(), m + 1);
+  std::copy(intrinsic.data(), intrinsic.data() + m + 1, v.data());
+
+  // The operator L V = alpha V[j-1] + beta V[j] + gamma V[j+1] discretizing the right hand side of the PDE.
+  double a = 0.5 * vol * vol, b = rate - 0.5 * vol * vol;
+  double alpha = a / (dx * dx) - b / (2 * dx);
+  double beta = -2 * a / (dx * dx) - rate;
+  double gamma = a / (dx * dx) + b / (2 * dx);
+
+  double s_lo = exp(x[0]), s_hi = exp(x[m]);
+  auto boundary = [&](double s, double t) {
+    double value = std::max(sign * (s - strike * exp(-rate * t)), 0.0);
+    return american ? std::max(value, std::max(sign * (s - strike), 0.0)) : value;
+  };
+  // Puts are exercised at the lower end of the grid, and calls at the upper end.
+  bool exercise_low = sign < 0;
+
+  double t = 0;
+  int half_steps = 4;                                                  //  the Rannacher start-up
+  long total = half_steps + (steps - 2);
+  for (long n = 0; n < total; n++) {
+    bool startup = n < half_steps;
+    double h = startup ? dt / 2 : dt;
+    double theta = startup ? 1.0 : 0.5;                                //  the weight of the implicit part
+
+    for (long j = 1; j <= m - 1; j++)
+      rhs[j] = v[j] + (1 - theta) * h * (alpha * v[j - 1] + beta * v[j] + gamma * v[j + 1]);
+    t += h;
+    v[0] = boundary(s_lo, t);
+    v[m] = boundary(s_hi, t);
+
+    Tridiagonal A = {-theta * h * alpha, 1 - theta * h * beta, -theta * h * gamma};
+    const double *floor = american ? intrinsic.data() : nullptr;
+    if (american && method == ExerciseMethod::PSOR) {
+      if (!solve_psor(A, v.data(), rhs.data(), m, floor))
+        return std::numeric_limits<double>::quiet_NaN();
+    } else if (exercise_low)
+      solve_down(A, v.data(), rhs.data(), work.data(), m, floor);
+    else
+      solve_up(A, v.data(), rhs.data(), work.data(), m, floor);
+  }
+
+  if (grid) {
+    grid->spots.resize(m + 1);
+    grid->values.assign(v.data(), v.data() + m + 1);
+    for (long j = 0; j <= m; j++)
+      grid->spots[j] = exp(x[j]);
+  }
+  return v[m / 2];
+}
+
+double PriceAmericanCallPDE(double spot, double time_to_expiry, double strike, double rate, double vol, long num_space, long num_time, ExerciseMethod method, PDEGrid *grid) {
+  return SolveBlackScholesPDE(CallValueFromLog(strike), spot, time_to_expiry, rate, vol, num_space, num_time, true, method, grid);
+}
+
+double PriceAmericanPutPDE(double spot, double time_to_expiry, double strike, double rate, double vol, long num_space, long num_time, ExerciseMethod method, PDEGrid *grid) {
+  return SolveBlackScholesPDE(PutValueFromLog(strike), spot, time_to_expiry, rate, vol, num_space, num_time, true, method, grid);
+}
@@ -0,0 +1,59 @@
+// author: Z. Amir-Khosravi
+//
+// Declares a finite difference solver for the Black-Scholes PDE, an alternative to the binomial lattices for pricing
+// American options, and a cross-check on them.
+
+#ifndef PDE_H
+#define PDE_H
+
+#include <vector>
+#include "base.h"
+
+// How the solver enforces the early exercise constraint V >= intrinsic value at each time step:
+//
+//    BrennanSchwartz: solves the tridiagonal system by Gaussian elimination towards the exercise region, and applies
+//                     the constraint during the back substitution (M. Brennan, E. Schwartz, "The Valuation of American
+//                     Put Options", 1977). Exact for vanilla payoffs, whose exercise region is a single interval at
+//                     one end of the grid, and as cheap as a plain solve.
+//    PSOR:            projected successive over-relaxation, which iterates Gauss-Seidel sweeps with the constraint
+//                     applied at each node until they converge. Works for any exercise region, but takes several
+//                     sweeps per step, more on finer grids. If a step doesn't converge within a cap that grows with
+//                     the grid, the solver returns nan rather than an unconverged value.
+enum class ExerciseMethod { BrennanSchwartz, PSOR };
+
+// The values of the option at expiry-to-go T on the whole grid: values[j] is the value at the underlying spots[j].
+struct PDEGrid {
+  std::vector<double> spots, values;
+};
+
+double SolveBlackScholesPDE(const VanillaValueFromLog &f, double spot, double time_to_expiry, double rate, double vol,
+                            long num_space, long num_time, bool american,
+                            ExerciseMethod method = ExerciseMethod::BrennanSchwartz, PDEGrid *grid = nullptr);
+// Returns the value of a vanilla option, American if american is true and European otherwise, by solving
+//
+//    V_t = vol^2/2 V_xx + (rate - vol^2/2) V_x - rate V
+//
+// in x, the log of the underlying, and t, the time to expiry, with the Crank-Nicolson scheme on a uniform grid of
+// num_space intervals in x and num_time steps in t. The grid spans pde_num_std standard deviations of x at expiry on
+// each side of log(spot), widened if needed to keep the strike well inside, and has log(spot) on a node, so the
+// price needs no interpolation.
+//
+// The kink of the payoff at the strike makes plain Crank-Nicolson oscillate, so the first two steps are replaced by
+// four fully implicit half steps (Rannacher's start-up). Each step solves a tridiagonal system, by the Thomas
+// algorithm for European options, and by the given method for American ones. At the ends of the grid the value is
+// set to its limit far in or out of the money, max(sign * (S - K * exp(-rate * t)), 0), or the intrinsic value if
+// larger for American options.
+//
+// Returns nan if the PSOR sweeps of a step fail to converge, in which case grid is left as it was. If grid isn't
+// null, it is otherwise filled with the values at all the nodes of the grid, which give the price at a range of
+// spots from the same solve. The cost is O(num_space * num_time).
+
+const double pde_num_std = 5;
+
+double PriceAmericanCallPDE(double spot, double time_to_expiry, double strike, double rate, double vol, long num_space, long num_time, ExerciseMethod method = ExerciseMethod::BrennanSchwartz, PDEGrid *grid = nullptr);
+// Price an American call with the Crank-Nicolson solver above
+
+double PriceAmericanPutPDE(double spot, double time_to_expiry, double strike, double rate, double vol, long num_space, long num_time, ExerciseMethod method = ExerciseMethod::BrennanSchwartz, PDEGrid *grid = nullptr);
+// Price an American put with the Crank-Nicolson solver above
+
+#endif
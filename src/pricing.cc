@@ -4,25 +4,19 @@
   // well as the actual functions that return the price. The latter may be directly called by the interface.
 
 #include <functional>
+#include <vector>
 #include <cmath>
+#include <limits>
+#include <algorithm>
 #include <iostream>
 #include "pricing.h"
 #include "base.h"
+#include "kernels.h"
 
-CallValueFromLog::CallValueFromLog(double strike_): strike(strike_) {
-  logstrike = log(strike);
+CallValueFromLog::CallValueFromLog(double strike_): VanillaValueFromLog(strike_, 1) {
 }
 
-double CallValueFromLog::eval(double logvalue) const {
-  return logvalue > logstrike? exp(logvalue) - strike : 0;
-}
-
-PutValueFromLog::PutValueFromLog(double strike_): strike(strike_) {
-  logstrike = log(strike);
-}
-
-double PutValueFromLog::eval(double logvalue) const {
-  return logvalue < logstrike? strike - exp(logvalue) : 0;
+PutValueFromLog::PutValueFromLog(double strike_): VanillaValueFromLog(strike_, -1) {
 }
 
 
@@ -35,15 +29,10 @@ CallValueFromNormal::CallValueFromNormal(double spot_, double time_to_expiry_, d
 {
      drift = rate - (vol * vol) / 2;
      step_std = sqrt(time_to_expiry) * vol;
-     // threshold = (log(strike) - log(spot) - drift * time_to_expiry) / step_std;
+     threshold = (log(strike) - log(spot) - drift * time_to_expiry) / step_std;
      base_price_factor = spot * exp( drift * time_to_expiry);
  }
 
-double CallValueFromNormal::eval(double x) const { 
-     double payoff = base_price_factor * exp(x * step_std) - strike;
-     return payoff>0? payoff: 0;
- }
-
 PutValueFromNormal::PutValueFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_):
      spot(spot_),
      strike(strike_),
@@ -53,15 +42,10 @@ PutValueFromNormal::PutValueFromNormal(double spot_, double time_to_expiry_, dou
 {
      drift = rate - (vol * vol) / 2;
      step_std = sqrt(time_to_expiry) * vol;
-     // threshold = (log(strike) - log(spot) - drift * time_to_expiry) / step_std;
+     threshold = (log(strike) - log(spot) - drift * time_to_expiry) / step_std;
      base_price_factor = spot * exp( drift * time_to_expiry);
  }
 
-double PutValueFromNormal::eval(double x) const {            
-     double payoff = strike - base_price_factor * exp(x * step_std);
-     return payoff > 0 ?payoff: 0;
- }
-
 
 DigitalPutValueFromNormal::DigitalPutValueFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_):
      spot(spot_),
@@ -76,11 +60,6 @@ DigitalPutValueFromNormal::DigitalPutValueFromNormal(double spot_, double time_t
      base_price_factor = spot * exp( drift * time_to_expiry);
  }
 
-double DigitalPutValueFromNormal::eval(double x) const {     
-     double payoff = strike - base_price_factor * exp(x * step_std);
-     return payoff > 0 ?1: 0;
- }
-
 DigitalCallValueFromNormal::DigitalCallValueFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_):
      spot(spot_),
      strike(strike_),
@@ -94,33 +73,263 @@ DigitalCallValueFromNormal::DigitalCallValueFromNormal(double spot_, double time
      base_price_factor = spot * exp( drift * time_to_expiry);
  }
 
-double DigitalCallValueFromNormal::eval(double x) const {                        
-     double payoff = base_price_factor * exp(x * step_std) - strike;
-     return payoff>0? 1: 0;
- }
-
-double PriceVanillaEuCall(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds) {
+double PriceVanillaEuCall(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads, uint64_t seed) {
     CallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
  
-    return SimpleMC(payoff, num_rounds) * exp(-rate * time_to_expiry);    
+    return ParallelMC(payoff, num_rounds, num_threads, seed) * exp(-rate * time_to_expiry);    
 }
 
-double PriceVanillaEuPut(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds) {
+double PriceVanillaEuPut(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads, uint64_t seed) {
     PutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
 
-    return SimpleMC(payoff, num_rounds) * exp(-rate * time_to_expiry);
+    return ParallelMC(payoff, num_rounds, num_threads, seed) * exp(-rate * time_to_expiry);
 }
 
-double PriceDigitalEuCall(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds) {
+double PriceDigitalEuCall(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads, uint64_t seed) {
     DigitalCallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
  
-    return SimpleMC(payoff, num_rounds) * exp(-rate * time_to_expiry);   
+    return ParallelMC(payoff, num_rounds, num_threads, seed) * exp(-rate * time_to_expiry);   
+}
+
+double PriceDigitalEuPut(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads, uint64_t seed) {
+    DigitalPutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+
+    return ParallelMC(payoff, num_rounds, num_threads, seed) * exp(-rate * time_to_expiry);
+}
+
+// The tolerances are in units of the price, so the absolute one is divided by the discount factor for the sampling,
+// which is done on the undiscounted payoff.
+template <class Payoff>
+static MCResult PriceMC(const Payoff &payoff, double time_to_expiry, double rate, long max_rounds, double abs_tol, double rel_tol, int num_threads, uint64_t seed) {
+    double discount = exp(-rate * time_to_expiry);
+    MCResult r = ParallelMCToTolerance(SingleOutput<Payoff>(payoff), max_rounds, abs_tol / discount, rel_tol, num_threads, seed);
+    r.mean *= discount;
+    r.std_error *= discount;
+    return r;
+}
+
+MCResult PriceVanillaEuCallMC(double spot, double time_to_expiry, double strike, double rate, double vol, long max_rounds, double abs_tol, double rel_tol, int num_threads, uint64_t seed) {
+    CallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceMC(payoff, time_to_expiry, rate, max_rounds, abs_tol, rel_tol, num_threads, seed);
+}
+
+MCResult PriceVanillaEuPutMC(double spot, double time_to_expiry, double strike, double rate, double vol, long max_rounds, double abs_tol, double rel_tol, int num_threads, uint64_t seed) {
+    PutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceMC(payoff, time_to_expiry, rate, max_rounds, abs_tol, rel_tol, num_threads, seed);
+}
+
+MCResult PriceDigitalEuCallMC(double spot, double time_to_expiry, double strike, double rate, double vol, long max_rounds, double abs_tol, double rel_tol, int num_threads, uint64_t seed) {
+    DigitalCallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceMC(payoff, time_to_expiry, rate, max_rounds, abs_tol, rel_tol, num_threads, seed);
+}
+
+MCResult PriceDigitalEuPutMC(double spot, double time_to_expiry, double strike, double rate, double vol, long max_rounds, double abs_tol, double rel_tol, int num_threads, uint64_t seed) {
+    DigitalPutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceMC(payoff, time_to_expiry, rate, max_rounds, abs_tol, rel_tol, num_threads, seed);
+}
+
+ControlVariateFromNormal::ControlVariateFromNormal(const FunctionClass &payoff_, double spot_, double time_to_expiry_, double rate_, double vol_, MCControl control_, double control_strike_):
+     payoff(payoff_),
+     spot(spot_),
+     time_to_expiry(time_to_expiry_),
+     rate(rate_),
+     vol(vol_),
+     control_strike(control_strike_),
+     control(control_)
+{
+     step_std = sqrt(time_to_expiry) * vol;
+     log_base = log(spot) + (rate - (vol * vol) / 2) * time_to_expiry;
+}
+
+void ControlVariateFromNormal::eval_outputs(const double *x, double *const *y, long n) const {
+  payoff.eval_block(x, y[0], n);
+  if (control == MCControl::Underlying) {
+    for (long j = 0; j < n; j++)
+      y[1][j] = log_base + step_std * x[j];
+    ExpRow(y[1], y[1], n);
+  } else {
+    LogNormalPayoffRow(x, y[1], n, log_base, step_std, control_strike, control == MCControl::Call ? 1 : -1, false);
+  }
+}
+
+double ControlVariateFromNormal::control_mean(void) const {
+  if (control == MCControl::Underlying)
+    return spot * exp(rate * time_to_expiry);
+  OptionType type = control == MCControl::Call ? OptionType::Call : OptionType::Put;
+  return BlackScholes(type, spot, time_to_expiry, control_strike, rate, vol).price * exp(rate * time_to_expiry);
+}
+
+static MCResult PriceCV(const FunctionClass &payoff, double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control, double control_strike, int num_threads, uint64_t seed, double *beta) {
+    ControlVariateFromNormal f(payoff, spot, time_to_expiry, rate, vol, control, control_strike > 0 ? control_strike : strike);
+    double discount = exp(-rate * time_to_expiry);
+    MCResult r = ParallelMCControlVariate(f, f.control_mean(), num_rounds, num_threads, seed, beta);
+    r.mean *= discount;
+    r.std_error *= discount;
+    return r;
+}
+
+MCResult PriceVanillaEuCallCV(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control, double control_strike, int num_threads, uint64_t seed, double *beta) {
+    CallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceCV(payoff, spot, time_to_expiry, strike, rate, vol, num_rounds, control, control_strike, num_threads, seed, beta);
+}
+
+MCResult PriceVanillaEuPutCV(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control, double control_strike, int num_threads, uint64_t seed, double *beta) {
+    PutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceCV(payoff, spot, time_to_expiry, strike, rate, vol, num_rounds, control, control_strike, num_threads, seed, beta);
+}
+
+MCResult PriceDigitalEuCallCV(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control, double control_strike, int num_threads, uint64_t seed, double *beta) {
+    DigitalCallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceCV(payoff, spot, time_to_expiry, strike, rate, vol, num_rounds, control, control_strike, num_threads, seed, beta);
 }
 
-double PriceDigitalEuPut(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds) {
+MCResult PriceDigitalEuPutCV(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control, double control_strike, int num_threads, uint64_t seed, double *beta) {
     DigitalPutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceCV(payoff, spot, time_to_expiry, strike, rate, vol, num_rounds, control, control_strike, num_threads, seed, beta);
+}
+
+// The importance sampling pricers only sample the draws past the threshold of the payoff, where it's non-zero: above
+// it for calls, and below for puts. The tilted draws are centred at the threshold, or at 0 if the option is in the
+// money, where no tilting is needed.
+template <class Payoff>
+static MCResult PriceIS(const Payoff &payoff, double side, double time_to_expiry, double rate, long num_rounds, MCSampling sampling, int num_threads, uint64_t seed) {
+    double discount = exp(-rate * time_to_expiry);
+    double threshold = payoff.get_threshold();
+    MCResult r;
+    if (sampling == MCSampling::Stratified) {
+        r = StratifiedMC(payoff, threshold, side, 2 * num_rounds, num_threads, seed);
+        r.count = num_rounds;                                           //  counted in rounds, as TiltedMC() does
+    } else
+        r = TiltedMC(payoff, side * threshold > 0 ? threshold : 0, num_rounds, num_threads, seed);
+    r.mean *= discount;
+    r.std_error *= discount;
+    return r;
+}
+
+MCResult PriceVanillaEuCallIS(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCSampling sampling, int num_threads, uint64_t seed) {
+    CallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceIS(payoff, 1, time_to_expiry, rate, num_rounds, sampling, num_threads, seed);
+}
 
-    return SimpleMC(payoff, num_rounds) * exp(-rate * time_to_expiry);
+MCResult PriceVanillaEuPutIS(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCSampling sampling, int num_threads, uint64_t seed) {
+    PutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceIS(payoff, -1, time_to_expiry, rate, num_rounds, sampling, num_threads, seed);
+}
+
+MCResult PriceDigitalEuCallIS(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCSampling sampling, int num_threads, uint64_t seed) {
+    DigitalCallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceIS(payoff, 1, time_to_expiry, rate, num_rounds, sampling, num_threads, seed);
+}
+
+MCResult PriceDigitalEuPutIS(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCSampling sampling, int num_threads, uint64_t seed) {
+    DigitalPutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    return PriceIS(payoff, -1, time_to_expiry, rate, num_rounds, sampling, num_threads, seed);
+}
+
+GreeksFromNormal::GreeksFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_, double sign_, bool digital_):
+     spot(spot_),
+     strike(strike_),
+     time_to_expiry(time_to_expiry_),
+     rate(rate_),
+     vol(vol_),
+     sign(sign_),
+     digital(digital_)
+{
+     step_std = sqrt(time_to_expiry) * vol;
+     log_base = log(spot) + (rate - (vol * vol) / 2) * time_to_expiry;
+     discount = exp(-rate * time_to_expiry);
+}
+
+void GreeksFromNormal::eval_outputs(const double *x, double *const *y, long n) const {
+  double sqrt_t = sqrt(time_to_expiry);
+  LogNormalPayoffRow(x, y[0], n, log_base, step_std, strike, sign, digital);
+
+  if (digital) {
+    for (long j = 0; j < n; j++) {
+      double price = discount * y[0][j], z = x[j];
+      y[0][j] = price;
+      y[1][j] = price * z / (spot * step_std);
+      y[2][j] = price * ((z * z - 1) / vol - z * sqrt_t);
+      y[3][j] = price * (z * sqrt_t / vol - time_to_expiry);
+    }
+    return;
+  }
+
+  // The pathwise derivatives of the discounted payoff max(sign * (S - strike), 0) * discount, where
+  // S = exp(log_base + step_std * z), are sign * discount times dS/dspot = S/spot, dS/dvol = S * (z*sqrt(T) - vol*T)
+  // and, together with the derivative of the discount factor, strike * T, when the option ends in the money.
+  for (long j = 0; j < n; j++)
+    y[1][j] = log_base + step_std * x[j];
+  ExpRow(y[1], y[1], n);
+  for (long j = 0; j < n; j++) {
+    double s = y[1][j], w = y[0][j] > 0 ? sign * discount : 0;
+    y[0][j] *= discount;
+    y[1][j] = w * s / spot;
+    y[2][j] = w * s * (x[j] * sqrt_t - vol * time_to_expiry);
+    y[3][j] = w * strike * time_to_expiry;
+  }
+}
+
+static MCGreeks PriceGreeksMC(const GreeksFromNormal &payoff, long num_rounds, int num_threads, uint64_t seed) {
+  MCResult r[4];
+  ParallelMCOutputs(payoff, 4, num_rounds, num_threads, seed, r);
+  return {r[0].mean, r[1].mean, r[2].mean, r[3].mean, r[0].std_error, r[1].std_error, r[2].std_error, r[3].std_error};
+}
+
+MCGreeks PriceVanillaEuCallGreeks(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads, uint64_t seed) {
+  return PriceGreeksMC(GreeksFromNormal(spot, time_to_expiry, strike, rate, vol, 1, false), num_rounds, num_threads, seed);
+}
+
+MCGreeks PriceVanillaEuPutGreeks(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads, uint64_t seed) {
+  return PriceGreeksMC(GreeksFromNormal(spot, time_to_expiry, strike, rate, vol, -1, false), num_rounds, num_threads, seed);
+}
+
+MCGreeks PriceDigitalEuCallGreeks(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads, uint64_t seed) {
+  return PriceGreeksMC(GreeksFromNormal(spot, time_to_expiry, strike, rate, vol, 1, true), num_rounds, num_threads, seed);
+}
+
+MCGreeks PriceDigitalEuPutGreeks(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads, uint64_t seed) {
+  return PriceGreeksMC(GreeksFromNormal(spot, time_to_expiry, strike, rate, vol, -1, true), num_rounds, num_threads, seed);
+}
+
+double PriceVanillaEuCallQMC(double spot, double time_to_expiry, double strike, double rate, double vol, long num_points, int num_replicates, int num_threads, uint64_t seed, double *std_error) {
+    CallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    double discount = exp(-rate * time_to_expiry);
+
+    double price = SobolMC(payoff, num_points, num_replicates, Scrambling::Owen, num_threads, seed, std_error) * discount;
+    if (std_error)
+      *std_error *= discount;
+    return price;
+}
+
+double PriceVanillaEuPutQMC(double spot, double time_to_expiry, double strike, double rate, double vol, long num_points, int num_replicates, int num_threads, uint64_t seed, double *std_error) {
+    PutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    double discount = exp(-rate * time_to_expiry);
+
+    double price = SobolMC(payoff, num_points, num_replicates, Scrambling::Owen, num_threads, seed, std_error) * discount;
+    if (std_error)
+      *std_error *= discount;
+    return price;
+}
+
+double PriceDigitalEuCallQMC(double spot, double time_to_expiry, double strike, double rate, double vol, long num_points, int num_replicates, int num_threads, uint64_t seed, double *std_error) {
+    DigitalCallValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    double discount = exp(-rate * time_to_expiry);
+
+    double price = SobolMC(payoff, num_points, num_replicates, Scrambling::Owen, num_threads, seed, std_error) * discount;
+    if (std_error)
+      *std_error *= discount;
+    return price;
+}
+
+double PriceDigitalEuPutQMC(double spot, double time_to_expiry, double strike, double rate, double vol, long num_points, int num_replicates, int num_threads, uint64_t seed, double *std_error) {
+    DigitalPutValueFromNormal payoff(spot, time_to_expiry, strike, rate, vol);
+    double discount = exp(-rate * time_to_expiry);
+
+    double price = SobolMC(payoff, num_points, num_replicates, Scrambling::Owen, num_threads, seed, std_error) * discount;
+    if (std_error)
+      *std_error *= discount;
+    return price;
 }
 
 double PriceAmericanCallNaive(double spot, double time_to_expiry, double strike, double rate, double vol, long tree_depth) {
@@ -145,239 +354,337 @@ double PriceAmericanCallNaive(double spot, double time_to_expiry, double strike,
   double q = exp(-rate* time_delta) * (u - 1) / (u - d);
   V.MultiplicativeRollback(L, p, q, call_value);
 
-  return V.points[0][0];
+  return V(0,0);
 }
 
-double PriceAmericanCall(double spot, double time_to_expiry, double strike, double rate, double vol, long tree_depth) {
+// This function returns the parameters of one step of the given binomial model. For the models that only determine
+// u and d, down is set to 1/u.
 
-  double step_size = time_to_expiry/tree_depth;
-  
-  double A = (exp(-rate * step_size) + exp((rate + vol*vol)*step_size))/2;
-  
-  double u = A + sqrt(A*A - 1);
-  double d = A - sqrt(A*A - 1);
-
-  double p = (exp(rate * step_size) - d) / (u-d);
-  double q = 1-p;
-
-  Lattice L(tree_depth+1), V(tree_depth+1);
-  L.AdditiveForwardPass(log(spot), log(u));
-   
-  CallValueFromLog call_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * step_size) * p, exp(-rate * step_size) * q, call_value);
-  
-  return V.points[0][0];
+LatticeStep ModelStep(LatticeModel model, double time_to_expiry, double rate, double sigma, long N) {
+  double h = time_to_expiry/N;
+  double nu = rate - sigma*sigma/2;
+  double disc = exp(-rate * h);
+
+  LatticeStep step;
+  double p;
+
+  switch (model) {
+    case LatticeModel::AdHoc: {
+      double A = (exp(-rate * h) + exp((rate + sigma*sigma)*h))/2;
+      double u = A + sqrt(A*A - 1);
+      double d = A - sqrt(A*A - 1);
+      p = (exp(rate * h) - d) / (u-d);
+      step.logu = log(u);
+      step.logd = -log(u);
+      break;
+    }
+    case LatticeModel::Tian: {
+      // "A Modified Lattice Approach to Option Pricing" by Yison Tian (1993)
+      double M = exp(rate * h);
+      double V = exp(sigma * sigma * h);
+      double u = M*V*(V + 1 + sqrt(V*V + 2*V - 3))/2;
+      double d = M*V*(V + 1 - sqrt(V*V + 2*V - 3))/2;
+      p = (M-d)/(u-d);
+      step.logu = log(u);
+      step.logd = log(d);
+      step.p = p/M;
+      step.q = (1-p)/M;
+      return step;
+    }
+    case LatticeModel::CRR: {
+      double u = exp(sigma * sqrt(h));
+      p = 0.5 + nu * sqrt(h) / (2*sigma);
+      step.logu = log(u);
+      step.logd = -log(u);
+      break;
+    }
+    case LatticeModel::Trigeorgis: {
+      double logu = sqrt(sigma*sigma*h + nu*nu*h*h);
+      p = 0.5 + nu * h / (2*logu);
+      step.logu = logu;
+      step.logd = -logu;
+      break;
+    }
+    case LatticeModel::JarrowRudd: {
+      p = 0.5;
+      step.logu = nu * h + sigma * sqrt(h);
+      step.logd = nu * h - sigma * sqrt(h);
+      break;
+    }
+    case LatticeModel::JKY:
+    default: {
+      p = 0.5 + sigma * sqrt(h) / (2*sqrt(4+sigma*sigma*h));
+      step.logu = nu * h + (1-p)*sigma*sqrt(h)/sqrt(p*(1-p));
+      step.logd = nu * h - p*sigma*sqrt(h)/sqrt(p*(1-p));
+      break;
+    }
+  }
+
+  step.p = disc * p;
+  step.q = disc * (1-p);
+  return step;
 }
 
-double PriceAmericanCall_Tian(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+template <class Payoff>
+static double PriceAmerican(LatticeModel model, double spot, double time_to_expiry, const Payoff &f, double rate, double sigma, long N) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
 
-  double h = time_to_expiry/N;
-  double M = exp(rate * h);
-  double V = exp(sigma * sigma * h);
+  RollingLattice V(N+1);
+  return V.Rollback(log(spot), step.logu, step.logd, step.p, step.q, f);
+}
 
-  double u = M*V*(V + 1 + sqrt(V*V + 2*V - 3))/2;
-  double d = M*V*(V + 1 - sqrt(V*V + 2*V - 3))/2;
+double PriceAmericanCall(double spot, double time_to_expiry, double strike, double rate, double vol, long tree_depth) {
+  return PriceAmerican(LatticeModel::AdHoc, spot, time_to_expiry, CallValueFromLog(strike), rate, vol, tree_depth);
+}
 
-  double p = (M-d)/(u-d);
-  double q = 1 - p;
+double PriceAmericanPut(double spot, double time_to_expiry, double strike, double rate, double vol, long tree_depth) {
+  return PriceAmerican(LatticeModel::AdHoc, spot, time_to_expiry, PutValueFromLog(strike), rate, vol, tree_depth);
+}
 
-  Lattice L(N+1), C(N+1);
-  L.AdditiveForwardPass(log(spot), log(u), log(d));
-   
-  CallValueFromLog call_value(strike);
-  C.MultiplicativeRollback(L, p/M, q/M, call_value);
-  
-  return C.points[0][0];
+double PriceAmericanCall_Tian(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmerican(LatticeModel::Tian, spot, time_to_expiry, CallValueFromLog(strike), rate, sigma, N);
 }
 
 double PriceAmericanPut_Tian(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-
-  double h = time_to_expiry/N;
-  double M = exp(rate * h);
-  double V = exp(sigma * sigma * h);
-
-  double u = M*V*(V + 1 + sqrt(V*V + 2*V - 3))/2;
-  double d = M*V*(V + 1 - sqrt(V*V + 2*V - 3))/2;
-
-  double p = (M-d)/(u-d);
-  double q = 1 - p;
-
-  Lattice L(N+1), P(N+1);
-  L.AdditiveForwardPass(log(spot), log(u), log(d));
-   
-  PutValueFromLog put_value(strike);
-  P.MultiplicativeRollback(L, p/M, q/M, put_value);
-  
-  return P.points[0][0];
+  return PriceAmerican(LatticeModel::Tian, spot, time_to_expiry, PutValueFromLog(strike), rate, sigma, N);
 }
 
 double PriceAmericanCall_CRR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-  double h = time_to_expiry/N;
-
-  double nu = rate - sigma*sigma/2;
-  double u = exp(sigma * sqrt(h));
-
-  double p = 0.5 + nu * sqrt(h) / (2*sigma);
-  double q = 1-p;
-
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), log(u));
-   
-  CallValueFromLog call_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * h) * p, exp(-rate * h) * q, call_value);
-  
-  return V.points[0][0];
-
+  return PriceAmerican(LatticeModel::CRR, spot, time_to_expiry, CallValueFromLog(strike), rate, sigma, N);
 }
 
 double PriceAmericanPut_CRR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-  double h = time_to_expiry/N;
+  return PriceAmerican(LatticeModel::CRR, spot, time_to_expiry, PutValueFromLog(strike), rate, sigma, N);
+}
 
-  double nu = rate - sigma*sigma/2;
-  double u = exp(sigma * sqrt(h));
+double PriceAmericanCall_Trig(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmerican(LatticeModel::Trigeorgis, spot, time_to_expiry, CallValueFromLog(strike), rate, sigma, N);
+}
 
-  double p = 0.5 + nu * sqrt(h) / (2*sigma);
-  double q = 1-p;
+double PriceAmericanPut_Trig(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmerican(LatticeModel::Trigeorgis, spot, time_to_expiry, PutValueFromLog(strike), rate, sigma, N);
+}
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), log(u));
-   
-  PutValueFromLog put_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * h) * p, exp(-rate * h) * q, put_value);
-  
-  return V.points[0][0];
+double PriceAmericanCall_JR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmerican(LatticeModel::JarrowRudd, spot, time_to_expiry, CallValueFromLog(strike), rate, sigma, N);
+}
 
+double PriceAmericanPut_JR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmerican(LatticeModel::JarrowRudd, spot, time_to_expiry, PutValueFromLog(strike), rate, sigma, N);
 }
 
-double PriceAmericanPut(double spot, double time_to_expiry, double strike, double rate, double vol, long tree_depth) {
+double PriceAmericanCall_JKY(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmerican(LatticeModel::JKY, spot, time_to_expiry, CallValueFromLog(strike), rate, sigma, N);
+}
 
- double step_size = time_to_expiry/tree_depth;
-  
- double A = (exp(-rate * step_size) + exp((rate + vol*vol)*step_size))/2;
-  
- double u = A + sqrt(A*A - 1);
- double d = A - sqrt(A*A - 1);
+double PriceAmericanPut_JKY(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmerican(LatticeModel::JKY, spot, time_to_expiry, PutValueFromLog(strike), rate, sigma, N);
+}
 
- double p = (exp(rate * step_size) - d) / (u-d);
- double q = 1-p;
+// The chain pricers build the lattice once and roll all the strikes back together, see RollingLattice::RollbackChain().
 
- Lattice L(tree_depth+1), V(tree_depth+1);
- L.AdditiveForwardPass(log(spot), log(u));
-   
- PutValueFromLog put_value(strike);
- V.MultiplicativeRollback(L, exp(-rate * step_size) * p, exp(-rate * step_size) * q, put_value);
-  
- return V.points[0][0];
-}
+std::vector<double> PriceAmericanCallChain(LatticeModel model, double spot, double time_to_expiry, const std::vector<double> &strikes, double rate, double sigma, long N) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
 
-double PriceAmericanCall_Trig(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-  double h = time_to_expiry/N;
+  RollingLattice V(N+1);
+  return V.RollbackChain(log(spot), step.logu, step.logd, step.p, step.q, strikes, 1);
+}
 
-  double nu = rate - sigma*sigma/2;
-  double logu = sqrt(sigma*sigma*h + nu*nu*h*h);
+std::vector<double> PriceAmericanPutChain(LatticeModel model, double spot, double time_to_expiry, const std::vector<double> &strikes, double rate, double sigma, long N) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
 
-  double p = 0.5 + nu * h / (2*logu);
-  double q = 1 - p;
+  RollingLattice V(N+1);
+  return V.RollbackChain(log(spot), step.logu, step.logd, step.p, step.q, strikes, -1);
+}
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), logu);
-   
-  CallValueFromLog call_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * h) * p, exp(-rate * h) * q, call_value);
-  
-  return V.points[0][0];
+// The ladder pricers start the lattice m steps before the valuation date, with m just large enough for row m to span
+// the spots with a node to spare on each side. Row m then holds the N-step prices at m+1 spots, logu - logd apart in
+// log and centered on the middle of the ladder, and the price at each spot of the ladder is interpolated quadratically
+// through the three nearest nodes. That's a single rollback of N+m steps for all the spots, instead of one per spot.
+
+static std::vector<double> PriceAmericanLadder(LatticeModel model, const std::vector<double> &spots, double time_to_expiry, const VanillaValueFromLog &f, double rate, double sigma, long N) {
+  std::vector<double> prices(spots.size(), 0);
+  if (spots.empty())
+    return prices;
+
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
+  double dx = step.logu - step.logd;
+  auto range = std::minmax_element(spots.begin(), spots.end());
+  double lo = log(*range.first), hi = log(*range.second), center = (lo + hi) / 2;
+  long m = (long) ceil((hi - lo) / dx) + 2;
+  m += m & 1;                                                         //  even, so that node m/2 of row m is at center
+
+  RollingLattice V(N + m + 1);
+  double seed = center - m / 2 * (step.logu + step.logd);
+  const double *v = V.RollbackToRow(seed, step.logu, step.logd, step.p, step.q, f, m);
+
+  for (std::size_t a = 0; a < spots.size(); a++) {
+    double t = (log(spots[a]) - center) / dx + m / 2;                 //  the position of the spot in row m
+    long j = std::min(std::max(lround(t), 1L), m - 1);
+    double h = t - j;
+    prices[a] = v[j] + h * (v[j + 1] - v[j - 1]) / 2 + h * h * (v[j + 1] - 2 * v[j] + v[j - 1]) / 2;
+  }
+  return prices;
+}
 
+std::vector<double> PriceAmericanCallLadder(LatticeModel model, const std::vector<double> &spots, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmericanLadder(model, spots, time_to_expiry, CallValueFromLog(strike), rate, sigma, N);
 }
 
-double PriceAmericanCall_JR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-  double h = time_to_expiry/N;
+std::vector<double> PriceAmericanPutLadder(LatticeModel model, const std::vector<double> &spots, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmericanLadder(model, spots, time_to_expiry, PutValueFromLog(strike), rate, sigma, N);
+}
 
-  double nu = rate - sigma*sigma/2;
-  double logu = nu * h + sigma * sqrt(h);
-  double logd = nu * h - sigma * sqrt(h);
-  double p = 0.5;
+// The truncated pricers roll back a band of the lattice, see RollingLattice::RollbackTruncated().
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), logu, logd);
-   
-  CallValueFromLog call_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * h) * p, exp(-rate * h) * (1-p), call_value);
-  
-  return V.points[0][0];
+double PriceAmericanCallTruncated(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, double num_std, double *error_bound) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
 
+  RollingLattice V(N+1);
+  return V.RollbackTruncated(log(spot), step.logu, step.logd, step.p, step.q, CallValueFromLog(strike), num_std, error_bound);
 }
 
-double PriceAmericanPut_JR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-  double h = time_to_expiry/N;
+double PriceAmericanPutTruncated(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, double num_std, double *error_bound) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
 
-  double nu = rate - sigma*sigma/2;
-  double logu = nu * h + sigma * sqrt(h);
-  double logd = nu * h - sigma * sqrt(h);
-  double p = 0.5;
+  RollingLattice V(N+1);
+  return V.RollbackTruncated(log(spot), step.logu, step.logd, step.p, step.q, PutValueFromLog(strike), num_std, error_bound);
+}
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), logu, logd);
-   
-  PutValueFromLog put_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * h) * p, exp(-rate * h) * (1-p), put_value);
-  
-  return V.points[0][0];
+// Richardson extrapolation. The error of the lattice prices behaves like c/N plus an oscillating term, so combining
+// the prices at N and 2N steps as 2 P(2N) - P(N) cancels the leading term. Both rollbacks use the same RollingLattice,
+// so the smaller one reuses the row of the larger one.
+
+template <class Payoff>
+static double PriceAmericanRichardson(LatticeModel model, double spot, double time_to_expiry, const Payoff &f, double rate, double sigma, long N) {
+  double seed = log(spot);
+  RollingLattice V(2*N+1);
+  LatticeStep fine = ModelStep(model, time_to_expiry, rate, sigma, 2*N);
+  double p_fine = V.Rollback(seed, fine.logu, fine.logd, fine.p, fine.q, f);
+
+  V.set_size(N+1);
+  LatticeStep coarse = ModelStep(model, time_to_expiry, rate, sigma, N);
+  double p_coarse = V.Rollback(seed, coarse.logu, coarse.logd, coarse.p, coarse.q, f);
+  return 2 * p_fine - p_coarse;
+}
 
+double PriceAmericanCallRichardson(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmericanRichardson(model, spot, time_to_expiry, CallValueFromLog(strike), rate, sigma, N);
 }
 
-double PriceAmericanPut_Trig(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-  double h = time_to_expiry/N;
+double PriceAmericanPutRichardson(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmericanRichardson(model, spot, time_to_expiry, PutValueFromLog(strike), rate, sigma, N);
+}
 
-  double nu = rate - sigma*sigma/2;
-  double logu = sqrt(sigma*sigma*h + nu*nu*h*h);
+// The binomial Black-Scholes method of Broadie and Detemple ("American Option Valuation: New Bounds, Approximations,
+// and a Comparison of Existing Methods", 1996) replaces the last step of the lattice by the Black-Scholes formula:
+// the values at step N-1 are the larger of the intrinsic value and the European price with one step h = T/N to go.
+// That removes the kink of the payoff from the lattice, and with it the oscillation of the error, so that the
+// Richardson extrapolation 2 P(2N) - P(N) of the result (BBSR) works much better than on the plain lattice.
+
+static double RollbackBBS(RollingLattice &V, LatticeModel model, double spot, double time_to_expiry, const VanillaValueFromLog &f, double rate, double sigma, long N) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
+  double seed = log(spot), h = time_to_expiry / N;
+  double strike = f.get_strike(), sign = f.get_sign();
+
+  V.set_size(N);                                                      //  rows 0, ..., N-1
+  WorkspaceBuffer spots(N);
+  for (long i = 0; i < N; i++)
+    spots[i] = seed + i * step.logu + (N - 1 - i) * step.logd;
+  ExpRow(spots.data(), spots.data(), N);
+
+  double *v = V.last_row();
+  const double *const inputs[5] = {spots.data(), &h, &strike, &rate, &sigma};
+  const long strides[5] = {1, 0, 0, 0, 0};
+  double *const outputs[8] = {v, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+  BlackScholes(sign > 0 ? OptionType::Call : OptionType::Put, N, inputs, strides, outputs);
+  for (long i = 0; i < N; i++)
+    v[i] = std::max(v[i], sign * (spots[i] - strike));
+
+  return V.RollbackFromRow(seed, step.logu, step.logd, step.p, step.q, f);
+}
 
-  double p = 0.5 + nu * h / (2*logu);
-  double q = 1 - p;
+static double PriceAmericanBBSR(LatticeModel model, double spot, double time_to_expiry, const VanillaValueFromLog &f, double rate, double sigma, long N) {
+  RollingLattice V(2*N);
+  double p_fine = RollbackBBS(V, model, spot, time_to_expiry, f, rate, sigma, 2*N);
+  double p_coarse = RollbackBBS(V, model, spot, time_to_expiry, f, rate, sigma, N);
+  return 2 * p_fine - p_coarse;
+}
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), logu);
-   
-  PutValueFromLog put_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * h) * p, exp(-rate * h) * q, put_value);
-  
-  return V.points[0][0];
+double PriceAmericanCallBBSR(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmericanBBSR(model, spot, time_to_expiry, CallValueFromLog(strike), rate, sigma, N);
+}
 
+double PriceAmericanPutBBSR(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
+  return PriceAmericanBBSR(model, spot, time_to_expiry, PutValueFromLog(strike), rate, sigma, N);
 }
 
-double PriceAmericanCall_JKY(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-  double h = time_to_expiry/N;
+double PriceAmericanCallBoundary(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, std::vector<double> *boundary) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
 
-  double nu = rate - sigma*sigma/2;
-  double p = 0.5 + sigma * sqrt(h) / (2*sqrt(4+sigma*sigma*h));
-  double logu = nu * h + (1-p)*sigma*sqrt(h)/sqrt(p*(1-p));
-  double logd = nu * h - p*sigma*sqrt(h)/sqrt(p*(1-p));
+  RollingLattice V(N+1);
+  return V.RollbackBoundary(log(spot), step.logu, step.logd, step.p, step.q, CallValueFromLog(strike), boundary);
+}
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), logu, logd);
-   
-  CallValueFromLog call_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * h) * p, exp(-rate * h) * (1-p), call_value);
-  
-  return V.points[0][0];
+double PriceAmericanPutBoundary(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, std::vector<double> *boundary) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
 
+  RollingLattice V(N+1);
+  return V.RollbackBoundary(log(spot), step.logu, step.logd, step.p, step.q, PutValueFromLog(strike), boundary);
 }
 
-double PriceAmericanPut_JKY(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
-  double h = time_to_expiry/N;
-
-  double nu = rate - sigma*sigma/2;
-  double p = 0.5 + sigma * sqrt(h) / (2*sqrt(4+sigma*sigma*h));
-  double logu = nu * h + (1-p)*sigma*sqrt(h)/sqrt(p*(1-p));
-  double logd = nu * h - p*sigma*sqrt(h)/sqrt(p*(1-p));
+// The Greeks pricers estimate delta and gamma from the differences of the values at the nodes of rows 1 and 2, and
+// theta by comparing the value at the middle node of row 2, two steps later, to the root. In models whose lattices
+// don't recombine at the spot, the middle node is off the spot and the difference is corrected to second order
+// using delta and gamma. Vega and rho are central differences of four more rollbacks, which reuse the memory of the
+// first one.
+
+template <class Payoff>
+static LatticeGreeks PriceAmericanGreeks(LatticeModel model, double spot, double time_to_expiry, const Payoff &f, double rate, double sigma, long N, bool vega_rho) {
+  LatticeStep step = ModelStep(model, time_to_expiry, rate, sigma, N);
+  double seed = log(spot);
+
+  RollingLattice V(N+1);
+  LatticeGreeks g;
+  g.price = V.Rollback(seed, step.logu, step.logd, step.p, step.q, f);
+
+  double v[6];
+  V.get_top_rows(v);
+  double s20 = exp(seed + 2 * step.logd), s21 = exp(seed + step.logu + step.logd), s22 = exp(seed + 2 * step.logu);
+  double s10 = exp(seed + step.logd), s11 = exp(seed + step.logu);
+
+  double delta_up = (v[2] - v[1]) / (s22 - s21);
+  double delta_down = (v[1] - v[0]) / (s21 - s20);
+  g.delta = (v[4] - v[3]) / (s11 - s10);
+  g.gamma = (delta_up - delta_down) / ((s22 - s20) / 2);
+
+  double ds = s21 - spot;
+  double h = time_to_expiry / N;
+  g.theta = (v[1] - v[5] - g.delta * ds - 0.5 * g.gamma * ds * ds) / (2 * h);
+
+  g.vega = g.rho = std::numeric_limits<double>::quiet_NaN();
+  if (vega_rho) {
+    double dsigma = 0.01 * sigma;
+    double drate = 1e-4;
+    double values[4];
+    LatticeStep bumped[4] = {ModelStep(model, time_to_expiry, rate, sigma + dsigma, N),
+                             ModelStep(model, time_to_expiry, rate, sigma - dsigma, N),
+                             ModelStep(model, time_to_expiry, rate + drate, sigma, N),
+                             ModelStep(model, time_to_expiry, rate - drate, sigma, N)};
+    for (int j = 0; j < 4; j++)
+      values[j] = V.Rollback(seed, bumped[j].logu, bumped[j].logd, bumped[j].p, bumped[j].q, f);
+    g.vega = (values[0] - values[1]) / (2 * dsigma);
+    g.rho = (values[2] - values[3]) / (2 * drate);
+  }
+  return g;
+}
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), logu, logd);
-   
-  PutValueFromLog put_value(strike);
-  V.MultiplicativeRollback(L, exp(-rate * h) * p, exp(-rate * h) * (1-p), put_value);
-  
-  return V.points[0][0];
+LatticeGreeks PriceAmericanCallGreeks(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, bool vega_rho) {
+  return PriceAmericanGreeks(model, spot, time_to_expiry, CallValueFromLog(strike), rate, sigma, N, vega_rho);
+}
 
+LatticeGreeks PriceAmericanPutGreeks(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, bool vega_rho) {
+  return PriceAmericanGreeks(model, spot, time_to_expiry, PutValueFromLog(strike), rate, sigma, N, vega_rho);
 }
 
 double PriceEuropeanCall_LR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N) {
@@ -397,13 +704,8 @@ double PriceEuropeanCall_LR(double spot, double time_to_expiry, double strike, d
   double u = rr*pp/p;
   double d = (rr - p*u)/(1-p);
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), log(u), log(d));
-   
   CallValueFromLog call_value(strike);
-  V.MultiplicativeRollbackEU(L, exp(-rate * h) * p, exp(-rate * h) * (1-p), call_value);
-  
-  return V.points[0][0];
+  return EuropeanBinomialSum(N, log(spot), log(u), log(d), exp(-rate * h) * p, exp(-rate * h) * (1-p), call_value);
 
 }
 
@@ -423,14 +725,26 @@ double PriceEuropeanPut_LR(double spot, double time_to_expiry, double strike, do
   double u = rr*pp/p;
   double d = (rr - p*u)/(1-p);
 
-  Lattice L(N+1), V(N+1);
-  L.AdditiveForwardPass(log(spot), log(u), log(d));
-   
   PutValueFromLog put_value(strike);
-  V.MultiplicativeRollbackEU(L, exp(-rate * h) * p, exp(-rate * h) * (1-p), put_value);
-  
-  return V.points[0][0];
+  return EuropeanBinomialSum(N, log(spot), log(u), log(d), exp(-rate * h) * p, exp(-rate * h) * (1-p), put_value);
 
 }
 
 
+
+void BlackScholes(OptionType type, long n, const double *const inputs[5], const long strides[5], double *const outputs[8]) {
+  double sign = type == OptionType::Call || type == OptionType::DigitalCall ? 1 : -1;
+  bool digital = type == OptionType::DigitalCall || type == OptionType::DigitalPut;
+
+  BlackScholesRow(n, inputs, strides, sign, digital, outputs);
+}
+
+BlackScholesGreeks BlackScholes(OptionType type, double spot, double time_to_expiry, double strike, double rate, double vol) {
+  BlackScholesGreeks g;
+  const double *const inputs[5] = {&spot, &time_to_expiry, &strike, &rate, &vol};
+  const long strides[5] = {0, 0, 0, 0, 0};
+  double *const outputs[8] = {&g.price, &g.delta, &g.gamma, &g.vega, &g.theta, &g.rho, &g.vanna, &g.volga};
+
+  BlackScholes(type, 1, inputs, strides, outputs);
+  return g;
+}
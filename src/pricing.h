@@ -6,75 +6,263 @@
 #ifndef PRICING_H
 #define PRICING_H
 
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
 #include "base.h"
 
 // This class represents the intrinsic value of a call option as a function of the log of the underlying.
-class CallValueFromNormal: public virtual FunctionClass {
+class CallValueFromNormal final: public virtual FunctionClass {
     public:
 	double eval(double x) const;
+	void eval_block(const double *x, double *y, long n) const;
 	CallValueFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_);
+	double get_threshold(void) const { return threshold; }
+	// The payoff is non-zero exactly at the draws above the threshold.
     private:
     	double spot, strike, time_to_expiry, rate, vol;
 	double drift, threshold, base_price_factor, step_std;
 };
 
 // This class represents the intrinsic value of a put option as a function of the log of the underlying.
-class PutValueFromLog: public virtual FunctionClass {
+class PutValueFromLog final: public VanillaValueFromLog {
   public:
     double eval(double x) const;
     PutValueFromLog(double strike_);
-  private:
-    double logstrike, strike;
 };
 
 
 // This class represents the intrinsic value of a call option as a function of the log of the underlying.
-class CallValueFromLog: public virtual FunctionClass {
+class CallValueFromLog final: public VanillaValueFromLog {
   public:
     double eval(double x) const;
     CallValueFromLog(double strike_);
-  private:
-    double logstrike, strike;
 };
 
 // This class represents the intrinsic value of a put option as a function of a normal random variable.
-class PutValueFromNormal: public virtual FunctionClass {
+class PutValueFromNormal final: public virtual FunctionClass {
     public:
         double eval(double x) const;
+	void eval_block(const double *x, double *y, long n) const;
 	PutValueFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_);
+	double get_threshold(void) const { return threshold; }
+	// The payoff is non-zero exactly at the draws below the threshold.
     private:
 	double spot, strike, time_to_expiry, rate, vol;
 	double drift, threshold, base_price_factor, step_std;
 };
 
 //This class represents the intrinsic value of a digital call option.
-class DigitalCallValueFromNormal: public virtual FunctionClass {
+class DigitalCallValueFromNormal final: public virtual FunctionClass {
     public:
 	double eval(double x) const;
+	void eval_block(const double *x, double *y, long n) const;
 	DigitalCallValueFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_);
+	double get_threshold(void) const { return threshold; }
+	// The payoff is non-zero exactly at the draws above the threshold.
     private:
 	double spot, strike, time_to_expiry, rate, vol;
 	double drift, threshold, base_price_factor, step_std;
 };
 
 // This class represents the intrinsic value of a digital put option.
-class DigitalPutValueFromNormal: public virtual FunctionClass {
+class DigitalPutValueFromNormal final: public virtual FunctionClass {
     public:
 	double eval(double x) const;
+	void eval_block(const double *x, double *y, long n) const;
 	DigitalPutValueFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_);
+	double get_threshold(void) const { return threshold; }
+	// The payoff is non-zero exactly at the draws below the threshold.
     private:
 	double spot, strike, time_to_expiry, rate, vol;
 	double drift, threshold, base_price_factor, step_std;
 };
 
+// The eval() methods are defined here rather than in pricing.cc so that the templated lattice and Monte Carlo methods
+// in base.h can inline them.
+
+inline double CallValueFromLog::eval(double logvalue) const {
+  return logvalue > logstrike? exp(logvalue) - strike : 0;
+}
+
+inline double PutValueFromLog::eval(double logvalue) const {
+  return logvalue < logstrike? strike - exp(logvalue) : 0;
+}
+
+inline double CallValueFromNormal::eval(double x) const {
+     double payoff = base_price_factor * exp(x * step_std) - strike;
+     return payoff>0? payoff: 0;
+ }
+
+inline double PutValueFromNormal::eval(double x) const {
+     double payoff = strike - base_price_factor * exp(x * step_std);
+     return payoff > 0 ?payoff: 0;
+ }
+
+inline double DigitalPutValueFromNormal::eval(double x) const {
+     double payoff = strike - base_price_factor * exp(x * step_std);
+     return payoff > 0 ?1: 0;
+ }
+
+inline double DigitalCallValueFromNormal::eval(double x) const {
+     double payoff = base_price_factor * exp(x * step_std) - strike;
+     return payoff>0? 1: 0;
+ }
+
+// The block versions write base_price_factor * exp(x * step_std) as exp(log(base_price_factor) + x * step_std), which
+// is what LogNormalPayoffRow() computes.
+
+inline void CallValueFromNormal::eval_block(const double *x, double *y, long n) const {
+  LogNormalPayoffRow(x, y, n, log(base_price_factor), step_std, strike, 1, false);
+}
+
+inline void PutValueFromNormal::eval_block(const double *x, double *y, long n) const {
+  LogNormalPayoffRow(x, y, n, log(base_price_factor), step_std, strike, -1, false);
+}
+
+inline void DigitalCallValueFromNormal::eval_block(const double *x, double *y, long n) const {
+  LogNormalPayoffRow(x, y, n, log(base_price_factor), step_std, strike, 1, true);
+}
+
+inline void DigitalPutValueFromNormal::eval_block(const double *x, double *y, long n) const {
+  LogNormalPayoffRow(x, y, n, log(base_price_factor), step_std, strike, -1, true);
+}
+
+// The controls available to the control variate pricers: the terminal value of the underlying, or the payoff of a
+// vanilla call or put, all of which have closed form expectations.
+enum class MCControl { Underlying, Call, Put };
+
+// This class evaluates a payoff given as a FunctionClass of a normal random variable, such as CallValueFromNormal,
+// together with a control, for ParallelMCControlVariate(). The underlying at the draw x is
+// spot * exp((rate - vol^2/2) * T + vol * sqrt(T) * x), and control_strike is the strike of a vanilla control.
+class ControlVariateFromNormal {
+  public:
+    ControlVariateFromNormal(const FunctionClass &payoff_, double spot_, double time_to_expiry_, double rate_, double vol_, MCControl control_, double control_strike_);
+    void eval_outputs(const double *x, double *const *y, long n) const;
+    // Sets y[0][j] to the payoff and y[1][j] to the control at x[j], for 0 <= j < n.
+    double control_mean(void) const;
+    // The expectation of the control, undiscounted.
+  private:
+    const FunctionClass &payoff;
+    double spot, time_to_expiry, rate, vol, control_strike;
+    MCControl control;
+    double log_base, step_std;
+};
+
+// This class computes the discounted payoff of a European vanilla or digital option as a function of a normal random
+// variable, together with estimators of its delta, vega and rho, for ParallelMCOutputs(). The vanilla options use the
+// pathwise derivatives of the payoff, and the digital ones, whose payoff has no useful derivative, the likelihood
+// ratio weights of the lognormal density:
+//
+//    delta: Z / (spot * vol * sqrt(T)),   vega: (Z^2 - 1) / vol - Z * sqrt(T),   rho: Z * sqrt(T) / vol - T
+//
+// sign is 1 for calls and -1 for puts.
+class GreeksFromNormal {
+  public:
+    GreeksFromNormal(double spot_, double time_to_expiry_, double strike_, double rate_, double vol_, double sign_, bool digital_);
+    void eval_outputs(const double *x, double *const *y, long n) const;
+    // Sets y[0][j], ..., y[3][j] to the estimators of the price, delta, vega and rho at x[j], for 0 <= j < n.
+  private:
+    double spot, strike, time_to_expiry, rate, vol, sign;
+    bool digital;
+    double log_base, step_std, discount;
+};
+
+// The binomial models implemented below. Leisen-Reimer is not in the list, since its lattice depends on the strike.
+enum class LatticeModel { AdHoc, Tian, CRR, Trigeorgis, JarrowRudd, JKY };
+
+// The parameters of one step of a binomial model: the log of the up and down factors, and the weights p and q of the
+// up and down moves, discounted over the step.
+struct LatticeStep {
+  double logu, logd, p, q;
+};
+
+LatticeStep ModelStep(LatticeModel model, double time_to_expiry, double rate, double sigma, long N);
+
+
+// The Monte Carlo pricers average over num_rounds antithetic pairs of draws, using ParallelMC() with the given number
+// of threads (0 for one per core) and seed. The result doesn't depend on the number of threads.
+
+double PriceVanillaEuCall(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads = 0, uint64_t seed = 12317);
+
+double PriceVanillaEuPut(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads = 0, uint64_t seed = 12317);
+
+double PriceDigitalEuCall(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads = 0, uint64_t seed = 12317);
+
+double PriceDigitalEuPut(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads = 0, uint64_t seed = 12317);
+
+// These pricers return the estimate of the Monte Carlo pricers above as an MCResult, with its standard error and the
+// number of antithetic pairs drawn. They stop as soon as the standard error of the price is at most
+// max(abs_tol, rel_tol * price), or after max_rounds pairs, see ParallelMCToTolerance(). With both tolerances 0 they
+// draw all max_rounds pairs, and give the price of the pricers above up to rounding.
+
+MCResult PriceVanillaEuCallMC(double spot, double time_to_expiry, double strike, double rate, double vol, long max_rounds, double abs_tol = 0, double rel_tol = 0, int num_threads = 0, uint64_t seed = 12317);
+
+MCResult PriceVanillaEuPutMC(double spot, double time_to_expiry, double strike, double rate, double vol, long max_rounds, double abs_tol = 0, double rel_tol = 0, int num_threads = 0, uint64_t seed = 12317);
+
+MCResult PriceDigitalEuCallMC(double spot, double time_to_expiry, double strike, double rate, double vol, long max_rounds, double abs_tol = 0, double rel_tol = 0, int num_threads = 0, uint64_t seed = 12317);
+
+MCResult PriceDigitalEuPutMC(double spot, double time_to_expiry, double strike, double rate, double vol, long max_rounds, double abs_tol = 0, double rel_tol = 0, int num_threads = 0, uint64_t seed = 12317);
+
+// These pricers use the given control on top of the antithetic draws of the Monte Carlo pricers, see
+// ParallelMCControlVariate(). A control_strike of 0 means the strike of the option. If beta isn't null, it is set to
+// the estimated coefficient of the control.
+
+MCResult PriceVanillaEuCallCV(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control = MCControl::Underlying, double control_strike = 0, int num_threads = 0, uint64_t seed = 12317, double *beta = nullptr);
+
+MCResult PriceVanillaEuPutCV(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control = MCControl::Underlying, double control_strike = 0, int num_threads = 0, uint64_t seed = 12317, double *beta = nullptr);
 
-double PriceVanillaEuCall(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds);
+MCResult PriceDigitalEuCallCV(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control = MCControl::Call, double control_strike = 0, int num_threads = 0, uint64_t seed = 12317, double *beta = nullptr);
 
-double PriceVanillaEuPut(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds);
+MCResult PriceDigitalEuPutCV(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCControl control = MCControl::Put, double control_strike = 0, int num_threads = 0, uint64_t seed = 12317, double *beta = nullptr);
 
-double PriceDigitalEuCall(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds);
+// The sampling schemes of the importance sampling pricers, see StratifiedMC() and TiltedMC() in base.h.
+enum class MCSampling { Stratified, Tilted };
 
-double PriceDigitalEuPut(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds);
+// These pricers only spend draws where the option pays off, which makes them suited to options far out of the money,
+// digital ones in particular. num_rounds counts rounds of two draws, as in the other Monte Carlo pricers: stratified
+// sampling takes 2 * num_rounds draws, one from each of as many strata of the region where the option is in the
+// money; tilted sampling takes num_rounds antithetic pairs of draws centred at the strike. Either way the count of
+// the result is num_rounds. For digitals, stratified sampling gives the exact price, up to the accuracy of the normal
+// quantiles, since the payoff is constant on the region.
+
+MCResult PriceVanillaEuCallIS(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCSampling sampling = MCSampling::Stratified, int num_threads = 0, uint64_t seed = 12317);
+
+MCResult PriceVanillaEuPutIS(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCSampling sampling = MCSampling::Stratified, int num_threads = 0, uint64_t seed = 12317);
+
+MCResult PriceDigitalEuCallIS(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCSampling sampling = MCSampling::Stratified, int num_threads = 0, uint64_t seed = 12317);
+
+MCResult PriceDigitalEuPutIS(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, MCSampling sampling = MCSampling::Stratified, int num_threads = 0, uint64_t seed = 12317);
+
+// The price of a European option estimated by Monte Carlo, its delta, vega and rho, and the standard errors of all four.
+struct MCGreeks {
+  double price, delta, vega, rho;
+  double price_error, delta_error, vega_error, rho_error;
+};
+
+// These pricers compute the price and the Greeks above in one pass over the draws of the Monte Carlo pricers, with
+// GreeksFromNormal and ParallelMCOutputs().
+
+MCGreeks PriceVanillaEuCallGreeks(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads = 0, uint64_t seed = 12317);
+
+MCGreeks PriceVanillaEuPutGreeks(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads = 0, uint64_t seed = 12317);
+
+MCGreeks PriceDigitalEuCallGreeks(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads = 0, uint64_t seed = 12317);
+
+MCGreeks PriceDigitalEuPutGreeks(double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds, int num_threads = 0, uint64_t seed = 12317);
+
+// The quasi-Monte Carlo pricers average over num_points points of an Owen-scrambled Sobol sequence, for each of
+// num_replicates independent scramblings, using SobolMC(). If std_error is not null, it is set to the standard error
+// of the price estimated from the replicates. num_points should preferably be a power of 2.
+
+double PriceVanillaEuCallQMC(double spot, double time_to_expiry, double strike, double rate, double vol, long num_points, int num_replicates = 16, int num_threads = 0, uint64_t seed = 12317, double *std_error = nullptr);
+
+double PriceVanillaEuPutQMC(double spot, double time_to_expiry, double strike, double rate, double vol, long num_points, int num_replicates = 16, int num_threads = 0, uint64_t seed = 12317, double *std_error = nullptr);
+
+double PriceDigitalEuCallQMC(double spot, double time_to_expiry, double strike, double rate, double vol, long num_points, int num_replicates = 16, int num_threads = 0, uint64_t seed = 12317, double *std_error = nullptr);
+
+double PriceDigitalEuPutQMC(double spot, double time_to_expiry, double strike, double rate, double vol, long num_points, int num_replicates = 16, int num_threads = 0, uint64_t seed = 12317, double *std_error = nullptr);
 
 // This function is a naive computation of a call price. It's included only as an example, and should not be used.
 double PriceAmericanCallNaive(double spot, double time_to_expiry, double strike, double rate, double vol, long tree_depth); 
@@ -116,10 +304,86 @@ double PriceAmericanPut_JKY(double spot, double time_to_expiry, double strike, d
 // Price an American put using the Trigeorgis binomial model
 
 
+std::vector<double> PriceAmericanCallChain(LatticeModel model, double spot, double time_to_expiry, const std::vector<double> &strikes, double rate, double sigma, long N);
+// Price American calls at each of the given strikes, using a single rollback of the given model
+
+std::vector<double> PriceAmericanPutChain(LatticeModel model, double spot, double time_to_expiry, const std::vector<double> &strikes, double rate, double sigma, long N);
+// Price American puts at each of the given strikes, using a single rollback of the given model
+
+std::vector<double> PriceAmericanCallLadder(LatticeModel model, const std::vector<double> &spots, double time_to_expiry, double strike, double rate, double sigma, long N);
+// Price an American call at each of the given spots, which must be positive, using a single rollback of a lattice of
+// the given model started a few steps before the valuation date. The prices are interpolated between its nodes.
+
+std::vector<double> PriceAmericanPutLadder(LatticeModel model, const std::vector<double> &spots, double time_to_expiry, double strike, double rate, double sigma, long N);
+// Price an American put at each of the given spots, using a single rollback as above
+
+double PriceAmericanCallTruncated(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, double num_std = 6, double *error_bound = nullptr);
+// Price an American call with the given model, only computing the nodes within num_std standard deviations of the
+// forward, see RollingLattice::RollbackTruncated(). If error_bound isn't null, it is set to a bound on the error due
+// to the truncation.
+
+double PriceAmericanPutTruncated(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, double num_std = 6, double *error_bound = nullptr);
+// Price an American put with the given model and a truncated lattice, as above
+
+
+double PriceAmericanCallRichardson(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N);
+// Price an American call with the given model, extrapolating from lattices of N and 2N steps: 2 P(2N) - P(N)
+
+double PriceAmericanPutRichardson(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N);
+// Price an American put with the given model and Richardson extrapolation, as above
+
+double PriceAmericanCallBBSR(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N);
+// Price an American call with the binomial Black-Scholes method of Broadie and Detemple on the given model, whose
+// last step uses the Black-Scholes formula, extrapolated from N and 2N steps as above
+
+double PriceAmericanPutBBSR(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N);
+// Price an American put with the binomial Black-Scholes method and Richardson extrapolation, as above
+
+double PriceAmericanCallBoundary(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, std::vector<double> *boundary = nullptr);
+// Price an American call with the given model, tracking the early exercise boundary instead of comparing with the
+// intrinsic value at every node, see RollingLattice::RollbackBoundary(). If boundary isn't null, it is set to the N
+// critical values of the underlying at times 0, T/N, ..., (N-1)T/N, NaN where the lattice has no exercised node.
+
+double PriceAmericanPutBoundary(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, std::vector<double> *boundary = nullptr);
+// Price an American put with the given model and its early exercise boundary, as above
+
+// The price of an option on a lattice and its Greeks. Delta, gamma and theta are read off the first three rows of the
+// lattice the price is computed on, and theta is minus the derivative with respect to the time to expiry, as for
+// BlackScholesGreeks. Vega and rho take two more rollbacks each and are NaN when they weren't asked for.
+struct LatticeGreeks {
+  double price, delta, gamma, theta, vega, rho;
+};
+
+LatticeGreeks PriceAmericanCallGreeks(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, bool vega_rho = false);
+// Price an American call with the given model along with its Greeks. N should be at least 2. If vega_rho is true,
+// vega and rho are computed by rolling back the same lattice with the vol and the rate bumped up and down.
+
+LatticeGreeks PriceAmericanPutGreeks(LatticeModel model, double spot, double time_to_expiry, double strike, double rate, double sigma, long N, bool vega_rho = false);
+// Price an American put with the given model along with its Greeks, as above
+
+
 double PriceEuropeanCall_LR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N);
 // Price an American call using the Trigeorgis binomial model
 
 double PriceEuropeanPut_LR(double spot, double time_to_expiry, double strike, double rate, double sigma, long N);
 // Price an American put using the Trigeorgis binomial model
 
+
+// The options the Black-Scholes closed forms below handle. The digital options are cash-or-nothing, paying 1.
+enum class OptionType { Call, Put, DigitalCall, DigitalPut };
+
+// The Black-Scholes price of an option and its Greeks. Theta is minus the derivative with respect to the time to
+// expiry, vanna is the derivative of delta with respect to vol, and volga the second derivative with respect to vol.
+struct BlackScholesGreeks {
+  double price, delta, gamma, vega, theta, rho, vanna, volga;
+};
+
+BlackScholesGreeks BlackScholes(OptionType type, double spot, double time_to_expiry, double strike, double rate, double vol);
+// Price an option with the Black-Scholes formula, on an underlying without dividends
+
+void BlackScholes(OptionType type, long n, const double *const inputs[5], const long strides[5], double *const outputs[8]);
+// Price n options at once with the vectorized kernel BlackScholesRow(), see kernels.h. inputs[] holds the spots,
+// times to expiry, strikes, rates and vols, with stride 0 for a value shared by all options and 1 for an array, and
+// outputs[] gets the fields of BlackScholesGreeks in order (or is null for the fields not needed).
+
 #endif
@@ -2,30 +2,44 @@
 #include <Python.h>
 #include <iostream>
 #include <vector>
+#include <cstring>
+#include <cmath>
 
 #include "transform.h"
 #include "base.h"
 #include "pricing.h"
+#include "pde.h"
+
+
+// On free-threaded builds (Python 3.13 and later), lists are read inside a critical section, since other threads may
+// be modifying them at the same time. Older versions don't have critical sections, and don't need them.
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+
+// Converts a Python list of numbers to a vector. Returns false, with a Python exception set, if fl_list isn't a list
+// or one of its entries isn't a number.
+bool doublevec_from_floatlist(PyObject *fl_list, std::vector<double> &v_double) {
+    if (!PyList_Check(fl_list)) {
+        PyErr_SetString(PyExc_TypeError, "expected a list of numbers");
+        return false;
+    }
 
-
-std::vector<double> doublevec_from_floatlist(PyObject *fl_list) {
-    std::vector<double> v_double = {} ;
-
-    if (!PyList_Check(fl_list)) 
-        return v_double;            // return empty vector if input is not a python list
-
-    int list_length = PyObject_Length(fl_list);
-
-    for (int i = 0 ; i < list_length ; i++) {
-        PyObject *x;
-        x = PyList_GetItem(fl_list, i);
-        if (!PyFloat_Check(x))
-            v_double.push_back(0);  // if list entry is not a float, 
-        else
-            v_double.push_back(PyFloat_AsDouble(x));
+    bool ok = true;
+    Py_BEGIN_CRITICAL_SECTION(fl_list);
+    Py_ssize_t list_length = PyList_GET_SIZE(fl_list);
+    for (Py_ssize_t i = 0 ; i < list_length ; i++) {
+        double x = PyFloat_AsDouble(PyList_GET_ITEM(fl_list, i));
+        if (x == -1 && PyErr_Occurred()) {
+            ok = false;
+            break;
+        }
+        v_double.push_back(x);
     }
+    Py_END_CRITICAL_SECTION();
 
-    return v_double;
+    return ok;
 }
 
 PyObject * floatlist_from_doublevec(std::vector<double> &v) {
@@ -43,15 +57,243 @@ static PyObject* PriceVanillaEuCallWrapper(PyObject *self, PyObject *args) {
     double spot, time_to_expiry, strike, rate, vol, price;
     PyObject *retobj;
     long num_rounds;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
 
 
-    if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds))
+    if (!PyArg_ParseTuple(args, "dddddl|iK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds, &num_threads, &seed))
         return nullptr;
-    price = PriceVanillaEuCall(spot, time_to_expiry, strike, rate, vol, num_rounds);
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceVanillaEuCall(spot, time_to_expiry, strike, rate, vol, num_rounds, num_threads, seed);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
 
+// Parses the arguments of the Monte Carlo functions with error control, (spot, time to expiry, strike, rate, vol,
+// maximum number of rounds[, absolute tolerance, relative tolerance, number of threads, seed]), and returns
+// (price, standard error, number of rounds drawn) computed by pricer.
+static PyObject* MCResultWrapper(PyObject *args, MCResult (*pricer)(double, double, double, double, double, long, double, double, int, uint64_t)) {
+    double spot, time_to_expiry, strike, rate, vol;
+    double abs_tol = 0, rel_tol = 0;
+    long max_rounds;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
+    MCResult r;
+
+    if (!PyArg_ParseTuple(args, "dddddl|ddiK", &spot, &time_to_expiry, &strike, &rate, &vol, &max_rounds, &abs_tol, &rel_tol, &num_threads, &seed))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    r = pricer(spot, time_to_expiry, strike, rate, vol, max_rounds, abs_tol, rel_tol, num_threads, seed);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(ddl)", r.mean, r.std_error, r.count);
+}
+
+static PyObject* PriceVanillaEuCallMCWrapper(PyObject *self, PyObject *args) {
+    return MCResultWrapper(args, PriceVanillaEuCallMC);
+}
+
+static PyObject* PriceVanillaEuPutMCWrapper(PyObject *self, PyObject *args) {
+    return MCResultWrapper(args, PriceVanillaEuPutMC);
+}
+
+static PyObject* PriceDigitalEuCallMCWrapper(PyObject *self, PyObject *args) {
+    return MCResultWrapper(args, PriceDigitalEuCallMC);
+}
+
+static PyObject* PriceDigitalEuPutMCWrapper(PyObject *self, PyObject *args) {
+    return MCResultWrapper(args, PriceDigitalEuPutMC);
+}
+
+// Parses the arguments of the control variate functions, (spot, time to expiry, strike, rate, vol, number of rounds
+// [, control, control strike, number of threads, seed]), where control is "underlying", "call" or "put", and returns
+// (price, standard error, number of rounds, beta) computed by pricer.
+static PyObject* MCControlVariateWrapper(PyObject *args, MCResult (*pricer)(double, double, double, double, double, long, MCControl, double, int, uint64_t, double *), MCControl control) {
+    double spot, time_to_expiry, strike, rate, vol, beta;
+    double control_strike = 0;
+    const char *control_name = nullptr;
+    long num_rounds;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
+    MCResult r;
+
+    if (!PyArg_ParseTuple(args, "dddddl|zdiK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds, &control_name, &control_strike, &num_threads, &seed))
+        return nullptr;
+    if (control_name) {
+        if (strcmp(control_name, "underlying") == 0)
+            control = MCControl::Underlying;
+        else if (strcmp(control_name, "call") == 0)
+            control = MCControl::Call;
+        else if (strcmp(control_name, "put") == 0)
+            control = MCControl::Put;
+        else {
+            PyErr_Format(PyExc_ValueError, "unknown control '%s'", control_name);
+            return nullptr;
+        }
+    }
+    Py_BEGIN_ALLOW_THREADS
+    r = pricer(spot, time_to_expiry, strike, rate, vol, num_rounds, control, control_strike, num_threads, seed, &beta);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(ddld)", r.mean, r.std_error, r.count, beta);
+}
+
+static PyObject* PriceVanillaEuCallCVWrapper(PyObject *self, PyObject *args) {
+    return MCControlVariateWrapper(args, PriceVanillaEuCallCV, MCControl::Underlying);
+}
+
+static PyObject* PriceVanillaEuPutCVWrapper(PyObject *self, PyObject *args) {
+    return MCControlVariateWrapper(args, PriceVanillaEuPutCV, MCControl::Underlying);
+}
+
+static PyObject* PriceDigitalEuCallCVWrapper(PyObject *self, PyObject *args) {
+    return MCControlVariateWrapper(args, PriceDigitalEuCallCV, MCControl::Call);
+}
+
+static PyObject* PriceDigitalEuPutCVWrapper(PyObject *self, PyObject *args) {
+    return MCControlVariateWrapper(args, PriceDigitalEuPutCV, MCControl::Put);
+}
+
+// Parses the arguments of the importance sampling functions, (spot, time to expiry, strike, rate, vol, number of
+// rounds[, sampling, number of threads, seed]), where sampling is "stratified" (the default) or "tilted", and returns
+// (price, standard error, number of rounds of two draws) computed by pricer.
+static PyObject* MCSamplingWrapper(PyObject *args, MCResult (*pricer)(double, double, double, double, double, long, MCSampling, int, uint64_t)) {
+    double spot, time_to_expiry, strike, rate, vol;
+    const char *sampling_name = "stratified";
+    MCSampling sampling;
+    long num_rounds;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
+    MCResult r;
+
+    if (!PyArg_ParseTuple(args, "dddddl|siK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds, &sampling_name, &num_threads, &seed))
+        return nullptr;
+    if (strcmp(sampling_name, "stratified") == 0)
+        sampling = MCSampling::Stratified;
+    else if (strcmp(sampling_name, "tilted") == 0)
+        sampling = MCSampling::Tilted;
+    else {
+        PyErr_Format(PyExc_ValueError, "unknown sampling '%s'", sampling_name);
+        return nullptr;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    r = pricer(spot, time_to_expiry, strike, rate, vol, num_rounds, sampling, num_threads, seed);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(ddl)", r.mean, r.std_error, r.count);
+}
+
+static PyObject* PriceVanillaEuCallISWrapper(PyObject *self, PyObject *args) {
+    return MCSamplingWrapper(args, PriceVanillaEuCallIS);
+}
+
+static PyObject* PriceVanillaEuPutISWrapper(PyObject *self, PyObject *args) {
+    return MCSamplingWrapper(args, PriceVanillaEuPutIS);
+}
+
+static PyObject* PriceDigitalEuCallISWrapper(PyObject *self, PyObject *args) {
+    return MCSamplingWrapper(args, PriceDigitalEuCallIS);
+}
+
+static PyObject* PriceDigitalEuPutISWrapper(PyObject *self, PyObject *args) {
+    return MCSamplingWrapper(args, PriceDigitalEuPutIS);
+}
+
+// Parses the arguments of the Monte Carlo Greeks functions, which are those of the Monte Carlo pricers, and returns
+// ((price, delta, vega, rho), (their standard errors)) computed by pricer.
+static PyObject* MCGreeksWrapper(PyObject *args, MCGreeks (*pricer)(double, double, double, double, double, long, int, uint64_t)) {
+    double spot, time_to_expiry, strike, rate, vol;
+    long num_rounds;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
+    MCGreeks g;
+
+    if (!PyArg_ParseTuple(args, "dddddl|iK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds, &num_threads, &seed))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    g = pricer(spot, time_to_expiry, strike, rate, vol, num_rounds, num_threads, seed);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("((dddd)(dddd))", g.price, g.delta, g.vega, g.rho, g.price_error, g.delta_error, g.vega_error, g.rho_error);
+}
+
+static PyObject* PriceVanillaEuCallGreeksWrapper(PyObject *self, PyObject *args) {
+    return MCGreeksWrapper(args, PriceVanillaEuCallGreeks);
+}
+
+static PyObject* PriceVanillaEuPutGreeksWrapper(PyObject *self, PyObject *args) {
+    return MCGreeksWrapper(args, PriceVanillaEuPutGreeks);
+}
+
+static PyObject* PriceDigitalEuCallGreeksWrapper(PyObject *self, PyObject *args) {
+    return MCGreeksWrapper(args, PriceDigitalEuCallGreeks);
+}
+
+static PyObject* PriceDigitalEuPutGreeksWrapper(PyObject *self, PyObject *args) {
+    return MCGreeksWrapper(args, PriceDigitalEuPutGreeks);
+}
+
+static PyObject* PriceVanillaEuCallQMCWrapper(PyObject *self, PyObject *args) {
+    double spot, time_to_expiry, strike, rate, vol, price, std_error;
+    long num_points;
+    int num_replicates = 16;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
+
+
+    if (!PyArg_ParseTuple(args, "dddddl|iiK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_points, &num_replicates, &num_threads, &seed))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceVanillaEuCallQMC(spot, time_to_expiry, strike, rate, vol, num_points, num_replicates, num_threads, seed, &std_error);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(dd)", price, std_error);
+}
+
+static PyObject* PriceVanillaEuPutQMCWrapper(PyObject *self, PyObject *args) {
+    double spot, time_to_expiry, strike, rate, vol, price, std_error;
+    long num_points;
+    int num_replicates = 16;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
+
+
+    if (!PyArg_ParseTuple(args, "dddddl|iiK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_points, &num_replicates, &num_threads, &seed))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceVanillaEuPutQMC(spot, time_to_expiry, strike, rate, vol, num_points, num_replicates, num_threads, seed, &std_error);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(dd)", price, std_error);
+}
+
+static PyObject* PriceDigitalEuCallQMCWrapper(PyObject *self, PyObject *args) {
+    double spot, time_to_expiry, strike, rate, vol, price, std_error;
+    long num_points;
+    int num_replicates = 16;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
+
+
+    if (!PyArg_ParseTuple(args, "dddddl|iiK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_points, &num_replicates, &num_threads, &seed))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceDigitalEuCallQMC(spot, time_to_expiry, strike, rate, vol, num_points, num_replicates, num_threads, seed, &std_error);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(dd)", price, std_error);
+}
+
+static PyObject* PriceDigitalEuPutQMCWrapper(PyObject *self, PyObject *args) {
+    double spot, time_to_expiry, strike, rate, vol, price, std_error;
+    long num_points;
+    int num_replicates = 16;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
+
+
+    if (!PyArg_ParseTuple(args, "dddddl|iiK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_points, &num_replicates, &num_threads, &seed))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceDigitalEuPutQMC(spot, time_to_expiry, strike, rate, vol, num_points, num_replicates, num_threads, seed, &std_error);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(dd)", price, std_error);
+}
+
 static PyObject* PriceAmericanCallWrapper(PyObject *self, PyObject *args) {
     double spot, time_to_expiry, strike, rate, vol, price;
     PyObject *retobj;
@@ -60,7 +302,9 @@ static PyObject* PriceAmericanCallWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanCall(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -73,7 +317,9 @@ static PyObject* PriceAmericanPutWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanPut(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -82,11 +328,15 @@ static PyObject* PriceVanillaEuPutWrapper(PyObject *self, PyObject *args) {
     double spot, time_to_expiry, strike, rate, vol, price;
     PyObject *retobj;
     long num_rounds;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
 
 
-    if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds))
+    if (!PyArg_ParseTuple(args, "dddddl|iK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds, &num_threads, &seed))
         return nullptr;
-    price = PriceVanillaEuPut(spot, time_to_expiry, strike, rate, vol, num_rounds);
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceVanillaEuPut(spot, time_to_expiry, strike, rate, vol, num_rounds, num_threads, seed);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -95,11 +345,15 @@ static PyObject* PriceDigitalEuCallWrapper(PyObject *self, PyObject *args) {
     double spot, time_to_expiry, strike, rate, vol, price;
     PyObject *retobj;
     long num_rounds;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
 
 
-    if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds))
+    if (!PyArg_ParseTuple(args, "dddddl|iK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds, &num_threads, &seed))
         return nullptr;
-    price = PriceDigitalEuCall(spot, time_to_expiry, strike, rate, vol, num_rounds);
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceDigitalEuCall(spot, time_to_expiry, strike, rate, vol, num_rounds, num_threads, seed);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -108,11 +362,15 @@ static PyObject* PriceDigitalEuPutWrapper(PyObject *self, PyObject *args) {
     double spot, time_to_expiry, strike, rate, vol, price;
     PyObject *retobj;
     long num_rounds;
+    int num_threads = 0;
+    unsigned long long seed = 12317;
 
 
-    if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds))
+    if (!PyArg_ParseTuple(args, "dddddl|iK", &spot, &time_to_expiry, &strike, &rate, &vol, &num_rounds, &num_threads, &seed))
         return nullptr;
-    price = PriceDigitalEuPut(spot, time_to_expiry, strike, rate, vol, num_rounds);
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceDigitalEuPut(spot, time_to_expiry, strike, rate, vol, num_rounds, num_threads, seed);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -125,7 +383,9 @@ static PyObject* PriceAmericanCallTianWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanCall_Tian(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -138,7 +398,9 @@ static PyObject* PriceAmericanPutTianWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanPut_Tian(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -151,7 +413,9 @@ static PyObject* PriceAmericanCallCRRWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanCall_CRR(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -164,7 +428,9 @@ static PyObject* PriceAmericanPutCRRWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanPut_CRR(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -177,7 +443,9 @@ static PyObject* PriceAmericanCallTrigWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanCall_Trig(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -190,7 +458,9 @@ static PyObject* PriceAmericanPutTrigWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanPut_Trig(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -203,7 +473,9 @@ static PyObject* PriceAmericanCallJRWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanCall_JR(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -216,7 +488,9 @@ static PyObject* PriceAmericanPutJRWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanPut_JR(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -229,7 +503,9 @@ static PyObject* PriceAmericanCallJKYWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanCall_JKY(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -242,7 +518,9 @@ static PyObject* PriceAmericanPutJKYWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceAmericanPut_JKY(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -255,7 +533,9 @@ static PyObject* PriceEuropeanCallLRWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceEuropeanCall_LR(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
@@ -268,17 +548,708 @@ static PyObject* PriceEuropeanPutLRWrapper(PyObject *self, PyObject *args) {
 
     if (!PyArg_ParseTuple(args, "dddddl", &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
         return nullptr;
+    Py_BEGIN_ALLOW_THREADS
     price = PriceEuropeanPut_LR(spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
     retobj = PyFloat_FromDouble(price);
     return retobj;
 }
 
+// Returns false if name is not one of the model names used by this module: "AdHoc", "Tian", "CRR", "Trig", "JR", "JKY"
+static bool lattice_model_from_name(const char *name, LatticeModel *model) {
+    static const struct { const char *name; LatticeModel model; } models[] = {
+        { "AdHoc", LatticeModel::AdHoc },
+        { "Tian", LatticeModel::Tian },
+        { "CRR", LatticeModel::CRR },
+        { "Trig", LatticeModel::Trigeorgis },
+        { "JR", LatticeModel::JarrowRudd },
+        { "JKY", LatticeModel::JKY },
+    };
+    for (auto &entry: models)
+        if (strcmp(name, entry.name) == 0) {
+            *model = entry.model;
+            return true;
+        }
+    PyErr_Format(PyExc_ValueError, "unknown lattice model '%s'", name);
+    return false;
+}
+
+static PyObject* PriceAmericanCallChainWrapper(PyObject *self, PyObject *args) {
+    const char *model_name;
+    double spot, time_to_expiry, rate, vol;
+    PyObject *strike_list;
+    long tree_depth;
+    LatticeModel model;
+
+
+    if (!PyArg_ParseTuple(args, "sddO!ddl", &model_name, &spot, &time_to_expiry, &PyList_Type, &strike_list, &rate, &vol, &tree_depth))
+        return nullptr;
+    if (!lattice_model_from_name(model_name, &model))
+        return nullptr;
+    std::vector<double> strikes;
+    if (!doublevec_from_floatlist(strike_list, strikes))
+        return nullptr;
+    std::vector<double> prices;
+    Py_BEGIN_ALLOW_THREADS
+    prices = PriceAmericanCallChain(model, spot, time_to_expiry, strikes, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
+    return floatlist_from_doublevec(prices);
+}
+
+static PyObject* PriceAmericanPutChainWrapper(PyObject *self, PyObject *args) {
+    const char *model_name;
+    double spot, time_to_expiry, rate, vol;
+    PyObject *strike_list;
+    long tree_depth;
+    LatticeModel model;
+
+
+    if (!PyArg_ParseTuple(args, "sddO!ddl", &model_name, &spot, &time_to_expiry, &PyList_Type, &strike_list, &rate, &vol, &tree_depth))
+        return nullptr;
+    if (!lattice_model_from_name(model_name, &model))
+        return nullptr;
+    std::vector<double> strikes;
+    if (!doublevec_from_floatlist(strike_list, strikes))
+        return nullptr;
+    std::vector<double> prices;
+    Py_BEGIN_ALLOW_THREADS
+    prices = PriceAmericanPutChain(model, spot, time_to_expiry, strikes, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
+    return floatlist_from_doublevec(prices);
+}
+
+// Parses the arguments of the ladder functions, (model, list of spots, time to expiry, strike, rate, vol, tree depth),
+// and returns the tuple of prices at the spots computed by pricer.
+static PyObject* LadderWrapper(PyObject *args, std::vector<double> (*pricer)(LatticeModel, const std::vector<double> &, double, double, double, double, long)) {
+    const char *model_name;
+    double time_to_expiry, strike, rate, vol;
+    PyObject *spot_list;
+    long tree_depth;
+    LatticeModel model;
+
+    if (!PyArg_ParseTuple(args, "sO!ddddl", &model_name, &PyList_Type, &spot_list, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
+        return nullptr;
+    if (!lattice_model_from_name(model_name, &model))
+        return nullptr;
+    std::vector<double> spots;
+    if (!doublevec_from_floatlist(spot_list, spots))
+        return nullptr;
+    for (double spot: spots)
+        if (!(spot > 0)) {
+            PyErr_SetString(PyExc_ValueError, "the spots must be positive");
+            return nullptr;
+        }
+    if (tree_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "the tree depth must be at least 1");
+        return nullptr;
+    }
+    std::vector<double> prices;
+    Py_BEGIN_ALLOW_THREADS
+    prices = pricer(model, spots, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
+    return floatlist_from_doublevec(prices);
+}
+
+static PyObject* PriceAmericanCallLadderWrapper(PyObject *self, PyObject *args) {
+    return LadderWrapper(args, PriceAmericanCallLadder);
+}
+
+static PyObject* PriceAmericanPutLadderWrapper(PyObject *self, PyObject *args) {
+    return LadderWrapper(args, PriceAmericanPutLadder);
+}
+
+static PyObject* PriceAmericanCallTruncatedWrapper(PyObject *self, PyObject *args) {
+    const char *model_name;
+    double spot, time_to_expiry, strike, rate, vol, price, error_bound;
+    double num_std = 6;
+    long tree_depth;
+    LatticeModel model;
+
+
+    if (!PyArg_ParseTuple(args, "sdddddl|d", &model_name, &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth, &num_std))
+        return nullptr;
+    if (!lattice_model_from_name(model_name, &model))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceAmericanCallTruncated(model, spot, time_to_expiry, strike, rate, vol, tree_depth, num_std, &error_bound);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(dd)", price, error_bound);
+}
+
+static PyObject* PriceAmericanPutTruncatedWrapper(PyObject *self, PyObject *args) {
+    const char *model_name;
+    double spot, time_to_expiry, strike, rate, vol, price, error_bound;
+    double num_std = 6;
+    long tree_depth;
+    LatticeModel model;
+
+
+    if (!PyArg_ParseTuple(args, "sdddddl|d", &model_name, &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth, &num_std))
+        return nullptr;
+    if (!lattice_model_from_name(model_name, &model))
+        return nullptr;
+    Py_BEGIN_ALLOW_THREADS
+    price = PriceAmericanPutTruncated(model, spot, time_to_expiry, strike, rate, vol, tree_depth, num_std, &error_bound);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(dd)", price, error_bound);
+}
+
+// Parses the arguments of the extrapolated lattice functions, (model, spot, time to expiry, strike, rate, vol, tree
+// depth), and returns the price computed by pricer.
+static PyObject* ExtrapolatedLatticeWrapper(PyObject *args, double (*pricer)(LatticeModel, double, double, double, double, double, long)) {
+    const char *model_name;
+    double spot, time_to_expiry, strike, rate, vol, price;
+    long tree_depth;
+    LatticeModel model;
+
+    if (!PyArg_ParseTuple(args, "sdddddl", &model_name, &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
+        return nullptr;
+    if (!lattice_model_from_name(model_name, &model))
+        return nullptr;
+    if (tree_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "the tree depth must be at least 1");
+        return nullptr;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    price = pricer(model, spot, time_to_expiry, strike, rate, vol, tree_depth);
+    Py_END_ALLOW_THREADS
+    return PyFloat_FromDouble(price);
+}
+
+static PyObject* PriceAmericanCallRichardsonWrapper(PyObject *self, PyObject *args) {
+    return ExtrapolatedLatticeWrapper(args, PriceAmericanCallRichardson);
+}
+
+static PyObject* PriceAmericanPutRichardsonWrapper(PyObject *self, PyObject *args) {
+    return ExtrapolatedLatticeWrapper(args, PriceAmericanPutRichardson);
+}
+
+static PyObject* PriceAmericanCallBBSRWrapper(PyObject *self, PyObject *args) {
+    return ExtrapolatedLatticeWrapper(args, PriceAmericanCallBBSR);
+}
+
+static PyObject* PriceAmericanPutBBSRWrapper(PyObject *self, PyObject *args) {
+    return ExtrapolatedLatticeWrapper(args, PriceAmericanPutBBSR);
+}
+
+// Parses the arguments of the boundary functions, (model, spot, time to expiry, strike, rate, vol, tree depth), and
+// returns the tuple (price, boundary) computed by pricer, with boundary the tuple of critical spots at each step.
+static PyObject* BoundaryWrapper(PyObject *args, double (*pricer)(LatticeModel, double, double, double, double, double, long, std::vector<double> *)) {
+    const char *model_name;
+    double spot, time_to_expiry, strike, rate, vol, price;
+    long tree_depth;
+    LatticeModel model;
+    std::vector<double> boundary;
+
+    if (!PyArg_ParseTuple(args, "sdddddl", &model_name, &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth))
+        return nullptr;
+    if (!lattice_model_from_name(model_name, &model))
+        return nullptr;
+    if (tree_depth < 1) {
+        PyErr_SetString(PyExc_ValueError, "the tree depth must be at least 1");
+        return nullptr;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    price = pricer(model, spot, time_to_expiry, strike, rate, vol, tree_depth, &boundary);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(dN)", price, floatlist_from_doublevec(boundary));
+}
+
+static PyObject* PriceAmericanCallBoundaryWrapper(PyObject *self, PyObject *args) {
+    return BoundaryWrapper(args, PriceAmericanCallBoundary);
+}
+
+static PyObject* PriceAmericanPutBoundaryWrapper(PyObject *self, PyObject *args) {
+    return BoundaryWrapper(args, PriceAmericanPutBoundary);
+}
+
+// Parses the arguments of the PDE functions, (spot, time to expiry, strike, rate, vol, space steps, time steps[, method,
+// grid]), where method is "brennan-schwartz" (the default) or "psor". Returns the price computed by pricer, or if grid
+// is true the tuple (price, spots, values) with the values at all the spots of the grid. Raises ArithmeticError if the
+// PSOR sweeps fail to converge.
+static PyObject* PDEWrapper(PyObject *args, double (*pricer)(double, double, double, double, double, long, long, ExerciseMethod, PDEGrid *)) {
+    double spot, time_to_expiry, strike, rate, vol, price;
+    long num_space, num_time;
+    const char *method_name = "brennan-schwartz";
+    ExerciseMethod method;
+    int want_grid = 0;
+    PDEGrid grid;
+
+    if (!PyArg_ParseTuple(args, "dddddll|sp", &spot, &time_to_expiry, &strike, &rate, &vol, &num_space, &num_time, &method_name, &want_grid))
+        return nullptr;
+    if (strcmp(method_name, "brennan-schwartz") == 0)
+        method = ExerciseMethod::BrennanSchwartz;
+    else if (strcmp(method_name, "psor") == 0)
+        method = ExerciseMethod::PSOR;
+    else {
+        PyErr_Format(PyExc_ValueError, "unknown exercise method '%s'", method_name);
+        return nullptr;
+    }
+    if (num_space < 2 || num_time < 2) {
+        PyErr_SetString(PyExc_ValueError, "the numbers of space and time steps must be at least 2");
+        return nullptr;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    price = pricer(spot, time_to_expiry, strike, rate, vol, num_space, num_time, method, want_grid ? &grid : nullptr);
+    Py_END_ALLOW_THREADS
+    if (method == ExerciseMethod::PSOR && std::isnan(price)) {
+        PyErr_SetString(PyExc_ArithmeticError, "the PSOR sweeps did not converge");
+        return nullptr;
+    }
+    if (!want_grid)
+        return PyFloat_FromDouble(price);
+    return Py_BuildValue("(dNN)", price, floatlist_from_doublevec(grid.spots), floatlist_from_doublevec(grid.values));
+}
+
+static PyObject* PriceAmericanCallPDEWrapper(PyObject *self, PyObject *args) {
+    return PDEWrapper(args, PriceAmericanCallPDE);
+}
+
+static PyObject* PriceAmericanPutPDEWrapper(PyObject *self, PyObject *args) {
+    return PDEWrapper(args, PriceAmericanPutPDE);
+}
+
+// Parses the arguments of the Greeks functions, (model, spot, time to expiry, strike, rate, vol, tree depth[, vega_rho]),
+// and returns the tuple (price, delta, gamma, theta, vega, rho) computed by pricer. Vega and rho are nan unless the
+// last flag is true.
+static PyObject* LatticeGreeksWrapper(PyObject *args, LatticeGreeks (*pricer)(LatticeModel, double, double, double, double, double, long, bool)) {
+    const char *model_name;
+    double spot, time_to_expiry, strike, rate, vol;
+    long tree_depth;
+    int vega_rho = 0;
+    LatticeModel model;
+    LatticeGreeks g;
+
+    if (!PyArg_ParseTuple(args, "sdddddl|p", &model_name, &spot, &time_to_expiry, &strike, &rate, &vol, &tree_depth, &vega_rho))
+        return nullptr;
+    if (!lattice_model_from_name(model_name, &model))
+        return nullptr;
+    if (tree_depth < 2) {
+        PyErr_SetString(PyExc_ValueError, "the tree depth must be at least 2 to compute the Greeks");
+        return nullptr;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    g = pricer(model, spot, time_to_expiry, strike, rate, vol, tree_depth, vega_rho);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(dddddd)", g.price, g.delta, g.gamma, g.theta, g.vega, g.rho);
+}
+
+static PyObject* PriceAmericanCallGreeksWrapper(PyObject *self, PyObject *args) {
+    return LatticeGreeksWrapper(args, PriceAmericanCallGreeks);
+}
+
+static PyObject* PriceAmericanPutGreeksWrapper(PyObject *self, PyObject *args) {
+    return LatticeGreeksWrapper(args, PriceAmericanPutGreeks);
+}
+
+// Reads an argument of the Black-Scholes functions, which is either a number or a list of numbers, into values, and
+// sets stride to 0 or 1 accordingly. n is the length of the lists read so far (-1 before the first one), and all
+// lists must have the same length. Returns false, with a Python exception set, if the argument isn't valid.
+static bool read_array_arg(PyObject *arg, std::vector<double> &values, long &stride, long &n) {
+    if (PyList_Check(arg)) {
+        if (!doublevec_from_floatlist(arg, values))
+            return false;
+        long length = values.size();
+        if (n >= 0 && length != n) {
+            PyErr_SetString(PyExc_ValueError, "list arguments must have the same length");
+            return false;
+        }
+        n = length;
+        stride = 1;
+        return true;
+    }
+
+    stride = 0;
+    values.push_back(PyFloat_AsDouble(arg));
+    return !(values.back() == -1 && PyErr_Occurred());
+}
+
+// The Black-Scholes functions take spot, time to expiry, strike, rate and vol, each a number or a list, and an
+// optional flag asking for the Greeks. They return the price, or the tuple (price, delta, gamma, vega, theta, rho,
+// vanna, volga) with the flag set. If any argument is a list, they return a tuple of prices instead (with one entry per
+// list element, the numbers being shared by all), or a tuple of 8 such tuples with the flag set.
+static PyObject* BlackScholesWrapper(PyObject *args, OptionType type) {
+    PyObject *arg[5];
+    int greeks = 0;
+
+
+    if (!PyArg_ParseTuple(args, "OOOOO|p", &arg[0], &arg[1], &arg[2], &arg[3], &arg[4], &greeks))
+        return nullptr;
+
+    std::vector<double> values[5];
+    const double *inputs[5];
+    long strides[5], n = -1;
+    for (int a = 0; a < 5; a++) {
+        if (!read_array_arg(arg[a], values[a], strides[a], n))
+            return nullptr;
+        inputs[a] = values[a].data();
+    }
+    bool scalar = n < 0;
+    if (scalar)
+        n = 1;
+
+    std::vector<double> results[8];
+    double *outputs[8] = {nullptr};
+    for (int a = 0; a < (greeks ? 8 : 1); a++) {
+        results[a].resize(n);
+        outputs[a] = results[a].data();
+    }
+    Py_BEGIN_ALLOW_THREADS
+    BlackScholes(type, n, inputs, strides, outputs);
+    Py_END_ALLOW_THREADS
+
+    if (scalar && !greeks)
+        return PyFloat_FromDouble(results[0][0]);
+    if (scalar)
+        return Py_BuildValue("(dddddddd)", results[0][0], results[1][0], results[2][0], results[3][0],
+                             results[4][0], results[5][0], results[6][0], results[7][0]);
+    if (!greeks)
+        return floatlist_from_doublevec(results[0]);
+
+    PyObject *tuple = PyTuple_New(8);
+    for (int a = 0; a < 8; a++)
+        PyTuple_SetItem(tuple, a, floatlist_from_doublevec(results[a]));
+    return tuple;
+}
+
+static PyObject* BlackScholesEuCallWrapper(PyObject *self, PyObject *args) {
+    return BlackScholesWrapper(args, OptionType::Call);
+}
+
+static PyObject* BlackScholesEuPutWrapper(PyObject *self, PyObject *args) {
+    return BlackScholesWrapper(args, OptionType::Put);
+}
+
+static PyObject* BlackScholesDigitalEuCallWrapper(PyObject *self, PyObject *args) {
+    return BlackScholesWrapper(args, OptionType::DigitalCall);
+}
+
+static PyObject* BlackScholesDigitalEuPutWrapper(PyObject *self, PyObject *args) {
+    return BlackScholesWrapper(args, OptionType::DigitalPut);
+}
+
+
+// The array versions of the functions above. Each of spot, time to expiry, strike, rate and vol is either a number,
+// shared by all options, or an object exporting a C-contiguous buffer of doubles (a float64 NumPy array, an
+// array.array('d'), ...), which is read in place without copying. All buffers must have the same length n, and the
+// prices are written to the buffer given as the keyword argument out, which must be writable and have length n as
+// well. Without out, a new array.array('d') is returned. The GIL is released while the prices are computed.
+
+// An input of an array function, giving value(j) for the option j
+class ArrayArg {
+  public:
+    ~ArrayArg(void) {
+        if (has_view)
+            PyBuffer_Release(&view);
+    }
+
+    // Reads obj, checking its length against n, the length of the buffers read so far (-1 before the first one).
+    // Returns false, with a Python exception set, on failure.
+    bool read(PyObject *obj, long &n) {
+        if (!PyObject_CheckBuffer(obj)) {
+            scalar = PyFloat_AsDouble(obj);
+            data = &scalar;
+            stride = 0;
+            return !(scalar == -1 && PyErr_Occurred());
+        }
+
+        if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+            return false;
+        has_view = true;
+        if (view.itemsize != sizeof(double) || !view.format || strcmp(view.format, "d") != 0) {
+            PyErr_SetString(PyExc_TypeError, "array arguments must hold doubles (float64)");
+            return false;
+        }
+        long length = view.len / sizeof(double);
+        if (n >= 0 && length != n) {
+            PyErr_SetString(PyExc_ValueError, "array arguments must have the same length");
+            return false;
+        }
+        n = length;
+        data = (const double *) view.buf;
+        stride = 1;
+        return true;
+    }
+
+    double value(long j) const { return data[j * stride]; }
+
+    const double *data = nullptr;
+    long stride = 0;
+
+  private:
+    Py_buffer view;
+    bool has_view = false;
+    double scalar;
+};
+
+// The output of an array function
+class ArrayOut {
+  public:
+    ~ArrayOut(void) {
+        if (has_view)
+            PyBuffer_Release(&view);
+        Py_XDECREF(obj);
+    }
+
+    // Gets the output buffer of length size from out, or from a new array if out is None (size < 0 means 1 then).
+    // Returns false, with a Python exception set, on failure.
+    bool open(PyObject *out, long size) {
+        if (out == Py_None) {
+            if (size < 0)
+                size = 1;
+            PyObject *array_module = PyImport_ImportModule("array");
+            if (!array_module)
+                return false;
+            PyObject *zeros = PyBytes_FromStringAndSize(nullptr, size * sizeof(double));
+            if (zeros)
+                obj = PyObject_CallMethod(array_module, "array", "sO", "d", zeros);
+            Py_XDECREF(zeros);
+            Py_DECREF(array_module);
+            if (!obj)
+                return false;
+        } else {
+            obj = out;
+            Py_INCREF(obj);
+        }
+
+        if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) < 0)
+            return false;
+        has_view = true;
+        if (view.itemsize != sizeof(double) || !view.format || strcmp(view.format, "d") != 0) {
+            PyErr_SetString(PyExc_TypeError, "out must hold doubles (float64)");
+            return false;
+        }
+        n = view.len / sizeof(double);
+        if (size >= 0 && n != size) {
+            PyErr_SetString(PyExc_ValueError, "out must have the same length as the array arguments");
+            return false;
+        }
+        data = (double *) view.buf;
+        return true;
+    }
+
+    // Returns a new reference to the output object
+    PyObject *result(void) {
+        Py_INCREF(obj);
+        return obj;
+    }
+
+    double *data = nullptr;
+    long n = 0;
+
+  private:
+    PyObject *obj = nullptr;
+    Py_buffer view;
+    bool has_view = false;
+};
+
+typedef double (*Pricer)(double spot, double time_to_expiry, double strike, double rate, double vol, long N);
+
+// The array version of a pricing function taking the five option parameters and a number of steps or draws N, which
+// is shared by all options. The options are priced in parallel on num_threads threads (0 for one per core).
+static PyObject* PriceArrayWrapper(PyObject *args, PyObject *kwargs, Pricer price) {
+    static const char *keywords[] = {"", "", "", "", "", "", "out", "num_threads", nullptr};
+    PyObject *arg[5], *out = Py_None;
+    long N;
+    int num_threads = 0;
+
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOOl|Oi", (char **) keywords, &arg[0], &arg[1], &arg[2], &arg[3], &arg[4], &N, &out, &num_threads))
+        return nullptr;
+
+    ArrayArg inputs[5];
+    long n = -1;
+    for (int a = 0; a < 5; a++)
+        if (!inputs[a].read(arg[a], n))
+            return nullptr;
+    ArrayOut output;
+    if (!output.open(out, n))
+        return nullptr;
+
+    double *prices = output.data;
+    Py_BEGIN_ALLOW_THREADS
+    ThreadPool::instance().run(output.n, num_threads, [&](long j) {
+        prices[j] = price(inputs[0].value(j), inputs[1].value(j), inputs[2].value(j), inputs[3].value(j), inputs[4].value(j), N);
+    });
+    Py_END_ALLOW_THREADS
+    return output.result();
+}
+
+static PyObject* PriceVanillaEuCallArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, [](double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds) {
+        return PriceVanillaEuCall(spot, time_to_expiry, strike, rate, vol, num_rounds, 1);
+    });
+}
+
+static PyObject* PriceVanillaEuPutArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, [](double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds) {
+        return PriceVanillaEuPut(spot, time_to_expiry, strike, rate, vol, num_rounds, 1);
+    });
+}
+
+static PyObject* PriceDigitalEuCallArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, [](double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds) {
+        return PriceDigitalEuCall(spot, time_to_expiry, strike, rate, vol, num_rounds, 1);
+    });
+}
+
+static PyObject* PriceDigitalEuPutArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, [](double spot, double time_to_expiry, double strike, double rate, double vol, long num_rounds) {
+        return PriceDigitalEuPut(spot, time_to_expiry, strike, rate, vol, num_rounds, 1);
+    });
+}
+
+static PyObject* PriceAmericanCallArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanCall);
+}
+
+static PyObject* PriceAmericanPutArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanPut);
+}
+
+static PyObject* PriceAmericanCallTianArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanCall_Tian);
+}
+
+static PyObject* PriceAmericanPutTianArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanPut_Tian);
+}
+
+static PyObject* PriceAmericanCallCRRArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanCall_CRR);
+}
+
+static PyObject* PriceAmericanPutCRRArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanPut_CRR);
+}
+
+static PyObject* PriceAmericanCallTrigArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanCall_Trig);
+}
+
+static PyObject* PriceAmericanPutTrigArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanPut_Trig);
+}
+
+static PyObject* PriceAmericanCallJRArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanCall_JR);
+}
+
+static PyObject* PriceAmericanPutJRArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanPut_JR);
+}
+
+static PyObject* PriceAmericanCallJKYArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanCall_JKY);
+}
+
+static PyObject* PriceAmericanPutJKYArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceAmericanPut_JKY);
+}
+
+static PyObject* PriceEuropeanCallLRArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceEuropeanCall_LR);
+}
+
+static PyObject* PriceEuropeanPutLRArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return PriceArrayWrapper(args, kwargs, PriceEuropeanPut_LR);
+}
+
+// The array versions of the Black-Scholes functions, with the same conventions as above. With the keyword argument
+// greeks set, out must have length 8n, and gets the prices followed by the deltas, gammas, vegas, thetas, rhos, vannas
+// and volgas (so a float64 NumPy array of shape (8, n) does). When all the arguments are numbers, n is 1.
+static PyObject* BlackScholesArrayWrapper(PyObject *args, PyObject *kwargs, OptionType type) {
+    static const char *keywords[] = {"", "", "", "", "", "out", "greeks", nullptr};
+    PyObject *arg[5], *out = Py_None;
+    int greeks = 0;
+
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOOO|Op", (char **) keywords, &arg[0], &arg[1], &arg[2], &arg[3], &arg[4], &out, &greeks))
+        return nullptr;
+
+    ArrayArg inputs[5];
+    long n = -1;
+    for (int a = 0; a < 5; a++)
+        if (!inputs[a].read(arg[a], n))
+            return nullptr;
+    ArrayOut output;
+    int num_outputs = greeks ? 8 : 1;
+    if (n < 0)                                                          //  all scalars: a single option
+        n = 1;
+    if (!output.open(out, n * num_outputs))
+        return nullptr;
+
+    const double *data[5];
+    long strides[5];
+    for (int a = 0; a < 5; a++) {
+        data[a] = inputs[a].data;
+        strides[a] = inputs[a].stride;
+    }
+    double *outputs[8] = {nullptr};
+    for (int a = 0; a < num_outputs; a++)
+        outputs[a] = output.data + a * n;
+
+    Py_BEGIN_ALLOW_THREADS
+    BlackScholes(type, n, data, strides, outputs);
+    Py_END_ALLOW_THREADS
+    return output.result();
+}
+
+static PyObject* BlackScholesEuCallArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return BlackScholesArrayWrapper(args, kwargs, OptionType::Call);
+}
+
+static PyObject* BlackScholesEuPutArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return BlackScholesArrayWrapper(args, kwargs, OptionType::Put);
+}
+
+static PyObject* BlackScholesDigitalEuCallArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return BlackScholesArrayWrapper(args, kwargs, OptionType::DigitalCall);
+}
+
+static PyObject* BlackScholesDigitalEuPutArrayWrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return BlackScholesArrayWrapper(args, kwargs, OptionType::DigitalPut);
+}
+
+// Frees the memory cached for lattices by every thread (see Workspace in base.h). An optional argument sets the
+// number of bytes each thread may keep cached from then on.
+static PyObject* ReleaseWorkspaceWrapper(PyObject *self, PyObject *args) {
+    Py_ssize_t max_bytes = -1;
+
+
+    if (!PyArg_ParseTuple(args, "|n", &max_bytes))
+        return nullptr;
+    if (max_bytes >= 0)
+        Workspace::set_limit(max_bytes);
+    Workspace::release_all();
+    Py_RETURN_NONE;
+}
 
 static PyMethodDef qtools_methods[] = {
-    { "PriceVanillaEuCall", PriceVanillaEuCallWrapper, METH_VARARGS, "Price a vanilla European call with simple Monte Carlo" },
-    { "PriceVanillaEuPut", PriceVanillaEuPutWrapper, METH_VARARGS, "Price a vanilla European put with simple Monte Carlo" },
-    { "PriceDigitalEuCall", PriceDigitalEuCallWrapper, METH_VARARGS, "Price a digital European call with simple Monte Carlo" },
-    { "PriceDigitalEuPut", PriceDigitalEuPutWrapper, METH_VARARGS, "Price a digital European put with simple Monte Carlo" },
+    { "PriceVanillaEuCall", PriceVanillaEuCallWrapper, METH_VARARGS, "Price a vanilla European call with parallel Monte Carlo; optional arguments: number of threads, seed" },
+    { "PriceVanillaEuPut", PriceVanillaEuPutWrapper, METH_VARARGS, "Price a vanilla European put with parallel Monte Carlo; optional arguments: number of threads, seed" },
+    { "PriceDigitalEuCall", PriceDigitalEuCallWrapper, METH_VARARGS, "Price a digital European call with parallel Monte Carlo; optional arguments: number of threads, seed" },
+    { "PriceDigitalEuPut", PriceDigitalEuPutWrapper, METH_VARARGS, "Price a digital European put with parallel Monte Carlo; optional arguments: number of threads, seed" },
+    { "PriceVanillaEuCallMC", PriceVanillaEuCallMCWrapper, METH_VARARGS, "Price a vanilla European call with parallel Monte Carlo, returning (price, standard error, number of rounds); optional arguments: absolute and relative tolerances at which to stop early, number of threads, seed" },
+    { "PriceVanillaEuPutMC", PriceVanillaEuPutMCWrapper, METH_VARARGS, "Price a vanilla European put with parallel Monte Carlo, returning (price, standard error, number of rounds); optional arguments: absolute and relative tolerances at which to stop early, number of threads, seed" },
+    { "PriceDigitalEuCallMC", PriceDigitalEuCallMCWrapper, METH_VARARGS, "Price a digital European call with parallel Monte Carlo, returning (price, standard error, number of rounds); optional arguments: absolute and relative tolerances at which to stop early, number of threads, seed" },
+    { "PriceDigitalEuPutMC", PriceDigitalEuPutMCWrapper, METH_VARARGS, "Price a digital European put with parallel Monte Carlo, returning (price, standard error, number of rounds); optional arguments: absolute and relative tolerances at which to stop early, number of threads, seed" },
+    { "PriceVanillaEuCallCV", PriceVanillaEuCallCVWrapper, METH_VARARGS, "Price a vanilla European call with Monte Carlo and a control variate, returning (price, standard error, number of rounds, beta); optional arguments: control ('underlying', 'call' or 'put', 'underlying' by default), control strike (the strike by default), number of threads, seed" },
+    { "PriceVanillaEuPutCV", PriceVanillaEuPutCVWrapper, METH_VARARGS, "Price a vanilla European put with Monte Carlo and a control variate, returning (price, standard error, number of rounds, beta); optional arguments: control ('underlying', 'call' or 'put', 'underlying' by default), control strike (the strike by default), number of threads, seed" },
+    { "PriceDigitalEuCallCV", PriceDigitalEuCallCVWrapper, METH_VARARGS, "Price a digital European call with Monte Carlo and a control variate, returning (price, standard error, number of rounds, beta); optional arguments: control ('underlying', 'call' or 'put', 'call' by default), control strike (the strike by default), number of threads, seed" },
+    { "PriceDigitalEuPutCV", PriceDigitalEuPutCVWrapper, METH_VARARGS, "Price a digital European put with Monte Carlo and a control variate, returning (price, standard error, number of rounds, beta); optional arguments: control ('underlying', 'call' or 'put', 'put' by default), control strike (the strike by default), number of threads, seed" },
+    { "PriceVanillaEuCallIS", PriceVanillaEuCallISWrapper, METH_VARARGS, "Price a vanilla European call with Monte Carlo draws only where it pays off, returning (price, standard error, number of rounds); optional arguments: sampling ('stratified' or 'tilted'), number of threads, seed" },
+    { "PriceVanillaEuPutIS", PriceVanillaEuPutISWrapper, METH_VARARGS, "Price a vanilla European put with Monte Carlo draws only where it pays off, returning (price, standard error, number of rounds); optional arguments: sampling ('stratified' or 'tilted'), number of threads, seed" },
+    { "PriceDigitalEuCallIS", PriceDigitalEuCallISWrapper, METH_VARARGS, "Price a digital European call with Monte Carlo draws only where it pays off, returning (price, standard error, number of rounds); optional arguments: sampling ('stratified' or 'tilted'), number of threads, seed" },
+    { "PriceDigitalEuPutIS", PriceDigitalEuPutISWrapper, METH_VARARGS, "Price a digital European put with Monte Carlo draws only where it pays off, returning (price, standard error, number of rounds); optional arguments: sampling ('stratified' or 'tilted'), number of threads, seed" },
+    { "PriceVanillaEuCallGreeks", PriceVanillaEuCallGreeksWrapper, METH_VARARGS, "Price a vanilla European call and its delta, vega and rho in one Monte Carlo pass, returning ((price, delta, vega, rho), (standard errors)); optional arguments: number of threads, seed" },
+    { "PriceVanillaEuPutGreeks", PriceVanillaEuPutGreeksWrapper, METH_VARARGS, "Price a vanilla European put and its delta, vega and rho in one Monte Carlo pass, returning ((price, delta, vega, rho), (standard errors)); optional arguments: number of threads, seed" },
+    { "PriceDigitalEuCallGreeks", PriceDigitalEuCallGreeksWrapper, METH_VARARGS, "Price a digital European call and its delta, vega and rho in one Monte Carlo pass, returning ((price, delta, vega, rho), (standard errors)); optional arguments: number of threads, seed" },
+    { "PriceDigitalEuPutGreeks", PriceDigitalEuPutGreeksWrapper, METH_VARARGS, "Price a digital European put and its delta, vega and rho in one Monte Carlo pass, returning ((price, delta, vega, rho), (standard errors)); optional arguments: number of threads, seed" },
+    { "PriceVanillaEuCallQMC", PriceVanillaEuCallQMCWrapper, METH_VARARGS, "Price a vanilla European call with scrambled Sobol quasi-Monte Carlo, returning (price, standard error); optional arguments: number of replicates, number of threads, seed" },
+    { "PriceVanillaEuPutQMC", PriceVanillaEuPutQMCWrapper, METH_VARARGS, "Price a vanilla European put with scrambled Sobol quasi-Monte Carlo, returning (price, standard error); optional arguments: number of replicates, number of threads, seed" },
+    { "PriceDigitalEuCallQMC", PriceDigitalEuCallQMCWrapper, METH_VARARGS, "Price a digital European call with scrambled Sobol quasi-Monte Carlo, returning (price, standard error); optional arguments: number of replicates, number of threads, seed" },
+    { "PriceDigitalEuPutQMC", PriceDigitalEuPutQMCWrapper, METH_VARARGS, "Price a digital European put with scrambled Sobol quasi-Monte Carlo, returning (price, standard error); optional arguments: number of replicates, number of threads, seed" },
     { "PriceAmericanCall", PriceAmericanCallWrapper, METH_VARARGS, "Price an American call option with a binomial tree model" },
     { "PriceAmericanPut", PriceAmericanPutWrapper, METH_VARARGS, "Price an American put option with a binomial tree model" },
     { "PriceAmericanCallTian", PriceAmericanCallTianWrapper, METH_VARARGS, "Price an American call with Tian's binomial model" },
@@ -291,22 +1262,75 @@ static PyMethodDef qtools_methods[] = {
     { "PriceAmericanPutJR", PriceAmericanPutJRWrapper, METH_VARARGS, "Price an American put option with the Jarrow-Rudd binomial model" },
     { "PriceAmericanCallJKY", PriceAmericanCallJKYWrapper, METH_VARARGS, "Price an American call option with the Jabbour-Kramin-Young binomial model" },
     { "PriceAmericanPutJKY", PriceAmericanPutJKYWrapper, METH_VARARGS, "Price an American put option with the Jabbour-Kramin-Young binomial model" },
+    { "PriceAmericanCallChain", PriceAmericanCallChainWrapper, METH_VARARGS, "Price American calls at a list of strikes with one rollback of the given binomial model" },
+    { "PriceAmericanPutChain", PriceAmericanPutChainWrapper, METH_VARARGS, "Price American puts at a list of strikes with one rollback of the given binomial model" },
+    { "PriceAmericanCallLadder", PriceAmericanCallLadderWrapper, METH_VARARGS, "Price an American call at a list of spots with one rollback of the given binomial model, started a few steps early" },
+    { "PriceAmericanPutLadder", PriceAmericanPutLadderWrapper, METH_VARARGS, "Price an American put at a list of spots with one rollback of the given binomial model, started a few steps early" },
+    { "PriceAmericanCallTruncated", PriceAmericanCallTruncatedWrapper, METH_VARARGS, "Price an American call with the given binomial model, skipping the nodes beyond some number of standard deviations (6 by default); returns (price, truncation error bound)" },
+    { "PriceAmericanPutTruncated", PriceAmericanPutTruncatedWrapper, METH_VARARGS, "Price an American put with the given binomial model, skipping the nodes beyond some number of standard deviations (6 by default); returns (price, truncation error bound)" },
+    { "PriceAmericanCallRichardson", PriceAmericanCallRichardsonWrapper, METH_VARARGS, "Price an American call with the given binomial model, extrapolated from N and 2N steps" },
+    { "PriceAmericanPutRichardson", PriceAmericanPutRichardsonWrapper, METH_VARARGS, "Price an American put with the given binomial model, extrapolated from N and 2N steps" },
+    { "PriceAmericanCallBBSR", PriceAmericanCallBBSRWrapper, METH_VARARGS, "Price an American call with the binomial Black-Scholes method on the given model, extrapolated from N and 2N steps" },
+    { "PriceAmericanPutBBSR", PriceAmericanPutBBSRWrapper, METH_VARARGS, "Price an American put with the binomial Black-Scholes method on the given model, extrapolated from N and 2N steps" },
+    { "PriceAmericanCallBoundary", PriceAmericanCallBoundaryWrapper, METH_VARARGS, "Price an American call with the given binomial model, tracking the early exercise boundary; returns (price, boundary) with the critical spot at each step, nan where nothing is exercised" },
+    { "PriceAmericanPutBoundary", PriceAmericanPutBoundaryWrapper, METH_VARARGS, "Price an American put with the given binomial model, tracking the early exercise boundary; returns (price, boundary) with the critical spot at each step, nan where nothing is exercised" },
+    { "PriceAmericanCallPDE", PriceAmericanCallPDEWrapper, METH_VARARGS, "Price an American call with a Crank-Nicolson finite difference solver; with the optional grid flag, returns (price, spots, values) over the whole grid" },
+    { "PriceAmericanPutPDE", PriceAmericanPutPDEWrapper, METH_VARARGS, "Price an American put with a Crank-Nicolson finite difference solver; with the optional grid flag, returns (price, spots, values) over the whole grid" },
+    { "PriceAmericanCallGreeks", PriceAmericanCallGreeksWrapper, METH_VARARGS, "Price an American call with the given binomial model along with its Greeks; returns (price, delta, gamma, theta, vega, rho), with vega and rho nan unless the optional flag is true" },
+    { "PriceAmericanPutGreeks", PriceAmericanPutGreeksWrapper, METH_VARARGS, "Price an American put with the given binomial model along with its Greeks; returns (price, delta, gamma, theta, vega, rho), with vega and rho nan unless the optional flag is true" },
     { "PriceEuropeanCallLR", PriceEuropeanCallLRWrapper, METH_VARARGS, "Price a European call option with the Leisen-Reimer binomial model" },
     { "PriceEuropeanPutLR", PriceEuropeanPutLRWrapper, METH_VARARGS, "Price a European put option with the Leisen-Reimer binomial model" },
+    { "BlackScholesEuCall", BlackScholesEuCallWrapper, METH_VARARGS, "Black-Scholes price of a European call; arguments may be lists, and an optional flag returns the Greeks too" },
+    { "BlackScholesEuPut", BlackScholesEuPutWrapper, METH_VARARGS, "Black-Scholes price of a European put; arguments may be lists, and an optional flag returns the Greeks too" },
+    { "BlackScholesDigitalEuCall", BlackScholesDigitalEuCallWrapper, METH_VARARGS, "Black-Scholes price of a digital European call; arguments may be lists, and an optional flag returns the Greeks too" },
+    { "BlackScholesDigitalEuPut", BlackScholesDigitalEuPutWrapper, METH_VARARGS, "Black-Scholes price of a digital European put; arguments may be lists, and an optional flag returns the Greeks too" },
+    { "PriceVanillaEuCallArray", (PyCFunction) (void (*)(void)) PriceVanillaEuCallArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceVanillaEuCall: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceVanillaEuPutArray", (PyCFunction) (void (*)(void)) PriceVanillaEuPutArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceVanillaEuPut: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceDigitalEuCallArray", (PyCFunction) (void (*)(void)) PriceDigitalEuCallArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceDigitalEuCall: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceDigitalEuPutArray", (PyCFunction) (void (*)(void)) PriceDigitalEuPutArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceDigitalEuPut: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanCallArray", (PyCFunction) (void (*)(void)) PriceAmericanCallArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanCall: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanPutArray", (PyCFunction) (void (*)(void)) PriceAmericanPutArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanPut: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanCallTianArray", (PyCFunction) (void (*)(void)) PriceAmericanCallTianArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanCallTian: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanPutTianArray", (PyCFunction) (void (*)(void)) PriceAmericanPutTianArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanPutTian: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanCallCRRArray", (PyCFunction) (void (*)(void)) PriceAmericanCallCRRArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanCallCRR: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanPutCRRArray", (PyCFunction) (void (*)(void)) PriceAmericanPutCRRArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanPutCRR: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanCallTrigArray", (PyCFunction) (void (*)(void)) PriceAmericanCallTrigArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanCallTrig: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanPutTrigArray", (PyCFunction) (void (*)(void)) PriceAmericanPutTrigArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanPutTrig: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanCallJRArray", (PyCFunction) (void (*)(void)) PriceAmericanCallJRArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanCallJR: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanPutJRArray", (PyCFunction) (void (*)(void)) PriceAmericanPutJRArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanPutJR: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanCallJKYArray", (PyCFunction) (void (*)(void)) PriceAmericanCallJKYArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanCallJKY: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceAmericanPutJKYArray", (PyCFunction) (void (*)(void)) PriceAmericanPutJKYArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceAmericanPutJKY: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceEuropeanCallLRArray", (PyCFunction) (void (*)(void)) PriceEuropeanCallLRArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceEuropeanCallLR: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "PriceEuropeanPutLRArray", (PyCFunction) (void (*)(void)) PriceEuropeanPutLRArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of PriceEuropeanPutLR: arguments are numbers or float64 buffers; keyword arguments: out, num_threads" },
+    { "BlackScholesEuCallArray", (PyCFunction) (void (*)(void)) BlackScholesEuCallArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of BlackScholesEuCall: arguments are numbers or float64 buffers; keyword arguments: out, greeks" },
+    { "BlackScholesEuPutArray", (PyCFunction) (void (*)(void)) BlackScholesEuPutArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of BlackScholesEuPut: arguments are numbers or float64 buffers; keyword arguments: out, greeks" },
+    { "BlackScholesDigitalEuCallArray", (PyCFunction) (void (*)(void)) BlackScholesDigitalEuCallArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of BlackScholesDigitalEuCall: arguments are numbers or float64 buffers; keyword arguments: out, greeks" },
+    { "BlackScholesDigitalEuPutArray", (PyCFunction) (void (*)(void)) BlackScholesDigitalEuPutArrayWrapper, METH_VARARGS | METH_KEYWORDS, "Array version of BlackScholesDigitalEuPut: arguments are numbers or float64 buffers; keyword arguments: out, greeks" },
+    { "release_workspace", ReleaseWorkspaceWrapper, METH_VARARGS, "Free the memory cached for lattices by every thread; optional argument: the number of bytes each thread may keep cached from now on" },
  { NULL, NULL, 0, NULL }
 };
 
+// The module keeps no state of its own, and the C++ code it wraps only shares the thread pool (which is safe to use
+// from several threads at once) between calls. So it works the same in every interpreter, and doesn't need the GIL.
+static PyModuleDef_Slot qtools_slots[] = {
+#ifdef Py_mod_multiple_interpreters
+    { Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+#ifdef Py_mod_gil
+    { Py_mod_gil, Py_MOD_GIL_NOT_USED },
+#endif
+    { 0, NULL }
+};
+
 static struct PyModuleDef qtools = {
     PyModuleDef_HEAD_INIT,
     "qtools",
     "Some tools for quantitative finance",
-    -1,
-    qtools_methods
+    0,
+    qtools_methods,
+    qtools_slots
 };
 
 PyMODINIT_FUNC PyInit_qtools(void) {
-    Py_Initialize();
-    // std::cout << "init\n";
-    return PyModule_Create(&qtools);
+    return PyModuleDef_Init(&qtools);
 }
-
@@ -21,6 +21,8 @@ double IntrinsicCallValue::eval(double x) const {
     return x > logstrike ? (exp(x) - strike): 0;
 }*/
 
+// Compares the full lattice with truncated ones, for a few widths of the band.
+
 int main(void) {
     double S0 = 120;
     double t = 3;
@@ -36,6 +38,12 @@ int main(void) {
 
     V0 = PriceAmericanPut(S0,t,strike,rate,vol,n);
     std::cout << "Put Price:" << V0 << std::endl;
+
+    for (double num_std: {4.0, 6.0, 8.0}) {
+        double bound;
+        double V = PriceAmericanPutTruncated(LatticeModel::AdHoc, S0, t, strike, rate, vol, n, num_std, &bound);
+        std::cout << "Put Price, truncated at " << num_std << " standard deviations:" << V
+                  << " (difference " << V - V0 << ", bound " << bound << ")" << std::endl;
+    }
     return 0;
 }
-